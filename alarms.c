@@ -0,0 +1,323 @@
+/****************************************************
+                          ALARMS.C
+This module holds the alarm thresholds for the tanks
+and checks the tank levels against them.
+****************************************************/
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "tankport.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "publics.h"
+#include "assert.h"
+
+/* Local Defines */
+/* Thresholds for tanks that are not in the table below */
+#define ALARM_DEFAULT_HIGH_HIGH  7500   /* Gallons */
+#define ALARM_DEFAULT_HIGH       7000   /* Gallons */
+#define ALARM_DEFAULT_LOW         500   /* Gallons */
+#define ALARM_DEFAULT_LEAK_RATE     1   /* Gallons per hour */
+
+/* Times vAlarmBenchmark scans every tank */
+#define ALARM_BENCH_PASSES       1000
+
+/* Local Structures */
+typedef struct
+{
+    int iHighHigh;     /* At or above this the tank is overflowing */
+    int iHigh;         /* At or above this the tank is nearly full */
+    int iLow;          /* At or below this the tank is nearly empty */
+    int iLeakRate;     /* A steady fall this fast is a leak */
+} ALARM_THRESHOLDS;
+
+typedef struct
+{
+    const int* a_iHighHigh;   /* The arrays to scan, one per field */
+    const int* a_iHigh;
+    const int* a_iLow;
+    const int* a_iLeakLimit;
+    const int* a_iLevel;
+    const int* a_iLeakRate;
+    const BYTE* a_byValid;
+} ALARM_ARRAYS;
+
+typedef struct
+{
+    ALARM_THRESHOLDS at;  /* The thresholds of one tank */
+    int iLevel;           /* Its latest level */
+    int iLeakRate;        /* How fast it is falling */
+    BOOL fValid;          /* TRUE if it has a reading */
+} ALARM_TANK;
+
+/* Static Functions */
+static void vAlarmScanArrays(const ALARM_ARRAYS* p_aa, int iTanks, BYTE* a_byAlarms);
+static BYTE byAlarmCheckTank(const ALARM_TANK* p_tk);
+
+/* Static Data */
+/* The thresholds for each tank, loaded by vAlarmSystemInit */
+static const ALARM_THRESHOLDS a_atTable[] =
+{
+    { 7500, 7000,  500, 1 },
+    { 7500, 7000,  500, 1 },
+    { 7600, 7200,  400, 1 }
+};
+
+/* The thresholds and the latest readings, one array per field, so
+   that vAlarmScan walks each of them straight through. */
+static int a_iHighHigh[COUNTOF_TANKS];
+static int a_iHigh[COUNTOF_TANKS];
+static int a_iLow[COUNTOF_TANKS];
+static int a_iLeakLimit[COUNTOF_TANKS];
+static int a_iLevel[COUNTOF_TANKS];
+static int a_iLeakRate[COUNTOF_TANKS];
+
+/* 0xFF for tanks that have a reading, 0 for those that do not */
+static BYTE a_byValid[COUNTOF_TANKS];
+
+/****** vAlarmSystemInit ************************************
+This routine loads the alarm thresholds for every tank.
+
+RETURNS: None.
+***********************************************************/
+void vAlarmSystemInit(void)
+{
+    /* LOCAL VARIABLES */
+    int iTank;         /* Tank iterator */
+
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        if (iTank < (int)(sizeof(a_atTable) / sizeof(a_atTable[0])))
+        {
+            a_iHighHigh[iTank] = a_atTable[iTank].iHighHigh;
+            a_iHigh[iTank] = a_atTable[iTank].iHigh;
+            a_iLow[iTank] = a_atTable[iTank].iLow;
+            a_iLeakLimit[iTank] = a_atTable[iTank].iLeakRate;
+        }
+        else
+        {
+            a_iHighHigh[iTank] = ALARM_DEFAULT_HIGH_HIGH;
+            a_iHigh[iTank] = ALARM_DEFAULT_HIGH;
+            a_iLow[iTank] = ALARM_DEFAULT_LOW;
+            a_iLeakLimit[iTank] = ALARM_DEFAULT_LEAK_RATE;
+        }
+
+        /* No readings yet. */
+        a_iLevel[iTank] = 0;
+        a_iLeakRate[iTank] = 0;
+        a_byValid[iTank] = 0;
+    }
+}
+
+/****** iAlarmHighHighLevel *********************************
+This routine returns the level at which a tank overflows.
+
+RETURNS: The level, in gallons.
+***********************************************************/
+int iAlarmHighHighLevel(int iTank)   /* The tank. */
+{
+    /* Check that the parameter is valid. */
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    return(a_iHighHigh[iTank]);
+}
+
+/****** vAlarmLevelSet **************************************
+This routine records the latest reading for a tank, to be
+checked at the next scan.
+
+RETURNS: None.
+***********************************************************/
+void vAlarmLevelSet(
+    int iTank,         /* The tank. */
+    int iLevel,        /* Its level, in gallons. */
+    int iLeakRate)     /* How fast it is steadily falling, in gallons
+                          per hour (0 if it is not). */
+{
+    /* Check that the parameter is valid. */
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    a_iLevel[iTank] = iLevel;
+    a_iLeakRate[iTank] = iLeakRate;
+    a_byValid[iTank] = 0xFF;
+}
+
+/****** vAlarmScan ******************************************
+This routine checks every threshold of every tank in a single
+pass.
+
+RETURNS: None.
+***********************************************************/
+void vAlarmScan(BYTE* a_byAlarms)   /* Place to put the ALARM_ bits
+                                       for each tank. */
+{
+    /* LOCAL VARIABLES */
+    ALARM_ARRAYS aa;   /* The arrays of every tank */
+
+    aa.a_iHighHigh = a_iHighHigh;
+    aa.a_iHigh = a_iHigh;
+    aa.a_iLow = a_iLow;
+    aa.a_iLeakLimit = a_iLeakLimit;
+    aa.a_iLevel = a_iLevel;
+    aa.a_iLeakRate = a_iLeakRate;
+    aa.a_byValid = a_byValid;
+    vAlarmScanArrays(&aa, COUNTOF_TANKS, a_byAlarms);
+}
+
+/****** vAlarmScanArrays ************************************
+This routine checks every threshold of iTanks tanks, one array
+per field.  The loop has no branches, so the compiler is free
+to vectorize it.
+
+RETURNS: None.
+***********************************************************/
+static void vAlarmScanArrays(
+    const ALARM_ARRAYS* p_aa, /* The tanks. */
+    int iTanks,               /* How many there are. */
+    BYTE* a_byAlarms)         /* Place to put the ALARM_ bits. */
+{
+    /* LOCAL VARIABLES */
+    ALARM_ARRAYS aa;   /* The arrays, where stores to a_byAlarms cannot
+                          change them */
+    int iTank;         /* Tank iterator */
+
+    aa = *p_aa;
+    for (iTank = 0; iTank < iTanks; ++iTank)
+    {
+        a_byAlarms[iTank] = (BYTE)(aa.a_byValid[iTank] & (
+            (aa.a_iLevel[iTank] >= aa.a_iHighHigh[iTank]) * ALARM_HIGH_HIGH |
+            (aa.a_iLevel[iTank] >= aa.a_iHigh[iTank]) * ALARM_HIGH |
+            (aa.a_iLevel[iTank] <= aa.a_iLow[iTank]) * ALARM_LOW |
+            (aa.a_iLeakRate[iTank] >= aa.a_iLeakLimit[iTank]) * ALARM_LEAK));
+    }
+}
+
+/****** byAlarmCheckTank ************************************
+This routine checks one tank the plain way, one threshold at a
+time.  vAlarmBenchmark holds vAlarmScanArrays to its answers.
+
+RETURNS: The ALARM_ bits for the tank.
+***********************************************************/
+static BYTE byAlarmCheckTank(const ALARM_TANK* p_tk)   /* The tank. */
+{
+    /* LOCAL VARIABLES */
+    BYTE byAlarms;     /* The alarms found */
+
+    byAlarms = 0;
+    if (!p_tk->fValid)
+        return(byAlarms);
+
+    if (p_tk->iLevel >= p_tk->at.iHighHigh)
+        byAlarms |= ALARM_HIGH_HIGH;
+    if (p_tk->iLevel >= p_tk->at.iHigh)
+        byAlarms |= ALARM_HIGH;
+    if (p_tk->iLevel <= p_tk->at.iLow)
+        byAlarms |= ALARM_LOW;
+    if (p_tk->iLeakRate >= p_tk->at.iLeakRate)
+        byAlarms |= ALARM_LEAK;
+
+    return(byAlarms);
+}
+
+/****** vAlarmBenchmark *************************************
+This routine scans iTanks made-up tanks, with levels spread over
+the whole tank so that every alarm turns up, both with
+vAlarmScanArrays and with a tank at a time, one structure per
+tank.  Every scan's answers are checked against each other, and
+both are timed.
+
+RETURNS: None.
+***********************************************************/
+void vAlarmBenchmark(
+    int iTanks,               /* How many tanks to scan. */
+    SELF_TEST* p_st)          /* Place to put the results. */
+{
+    /* LOCAL VARIABLES */
+    ALARM_ARRAYS aa;          /* The tanks, one array per field */
+    ALARM_TANK* a_tk;         /* The same tanks, one structure each */
+    int* a_iArrays;           /* The memory for the arrays */
+    BYTE* a_byValidBench;     /* Which tanks have a reading */
+    BYTE* a_byScan;           /* Alarms found by the scan */
+    BYTE* a_byPlain;          /* Alarms found a tank at a time */
+    unsigned long ulRandom;   /* Pseudo-random levels */
+    unsigned long long ullStart;  /* Time a pass started */
+    int iPass;                /* Iterator */
+    int iTank;                /* Iterator */
+
+    p_st->ulCases = 0;
+    p_st->ulFailures = 0;
+    p_st->ullMicroseconds = 0;
+    p_st->ullBaseline = 0;
+
+    a_tk = malloc(iTanks * sizeof(ALARM_TANK));
+    a_iArrays = malloc(6 * iTanks * sizeof(int));
+    a_byValidBench = malloc(iTanks);
+    a_byScan = malloc(iTanks);
+    a_byPlain = malloc(iTanks);
+    if (a_tk == NULL || a_iArrays == NULL || a_byValidBench == NULL
+        || a_byScan == NULL || a_byPlain == NULL)
+    {
+        ++p_st->ulFailures;
+        iTanks = 0;
+    }
+
+    aa.a_iHighHigh = a_iArrays;
+    aa.a_iHigh = a_iArrays + iTanks;
+    aa.a_iLow = a_iArrays + 2 * iTanks;
+    aa.a_iLeakLimit = a_iArrays + 3 * iTanks;
+    aa.a_iLevel = a_iArrays + 4 * iTanks;
+    aa.a_iLeakRate = a_iArrays + 5 * iTanks;
+    aa.a_byValid = a_byValidBench;
+
+    ulRandom = 1;
+    for (iTank = 0; iTank < iTanks; ++iTank)
+    {
+        a_tk[iTank].at = a_atTable[iTank % (sizeof(a_atTable) / sizeof(a_atTable[0]))];
+        ulRandom = ulRandom * 1103515245UL + 12345UL;
+        a_tk[iTank].iLevel = (ulRandom >> 16) % 8000;
+        ulRandom = ulRandom * 1103515245UL + 12345UL;
+        a_tk[iTank].iLeakRate = (ulRandom >> 16) % 3;
+        a_tk[iTank].fValid = iTank % 64 != 0;
+
+        a_iArrays[iTank] = a_tk[iTank].at.iHighHigh;
+        a_iArrays[iTanks + iTank] = a_tk[iTank].at.iHigh;
+        a_iArrays[2 * iTanks + iTank] = a_tk[iTank].at.iLow;
+        a_iArrays[3 * iTanks + iTank] = a_tk[iTank].at.iLeakRate;
+        a_iArrays[4 * iTanks + iTank] = a_tk[iTank].iLevel;
+        a_iArrays[5 * iTanks + iTank] = a_tk[iTank].iLeakRate;
+        a_byValidBench[iTank] = a_tk[iTank].fValid ? 0xFF : 0;
+    }
+
+    for (iPass = 0; iPass < ALARM_BENCH_PASSES && iTanks > 0; ++iPass)
+    {
+        /* One tank changes between scans, as it would for real. */
+        iTank = iPass % iTanks;
+        a_tk[iTank].iLevel = (a_tk[iTank].iLevel + 4001) % 8000;
+        a_iArrays[4 * iTanks + iTank] = a_tk[iTank].iLevel;
+
+        ullStart = ullStatsMicroseconds();
+        vAlarmScanArrays(&aa, iTanks, a_byScan);
+        p_st->ullMicroseconds += ullStatsMicroseconds() - ullStart;
+
+        ullStart = ullStatsMicroseconds();
+        for (iTank = 0; iTank < iTanks; ++iTank)
+            a_byPlain[iTank] = byAlarmCheckTank(&a_tk[iTank]);
+        p_st->ullBaseline += ullStatsMicroseconds() - ullStart;
+
+        for (iTank = 0; iTank < iTanks; ++iTank)
+        {
+            ++p_st->ulCases;
+            if (a_byScan[iTank] != a_byPlain[iTank])
+                ++p_st->ulFailures;
+        }
+    }
+
+    free(a_tk);
+    free(a_iArrays);
+    free(a_byValidBench);
+    free(a_byScan);
+    free(a_byPlain);
+}
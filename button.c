@@ -8,8 +8,7 @@ This module deals with the buttons.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include "tankport.h"
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -25,14 +24,113 @@ enum CMD_STATE
 {
     CMD_NONE,
     CMD_PRINT,
-    CMD_PRINT_HIST
+    CMD_PRINT_HIST,
+    CMD_STATES
 };
 
+/* The classes of key the command state machine tells apart. */
+enum KEY_CLASS
+{
+    KEY_OTHER,
+    KEY_TANK,
+    KEY_TIME,
+    KEY_PAGE,
+    KEY_PAGE_BACK,
+    KEY_RESET,
+    KEY_PRINT,
+    KEY_ALL,
+    KEY_HIST,
+    KEY_CLASSES
+};
+
+/* What to do for a key in a state, and the state to go to. */
+typedef struct
+{
+    void (*vAction)(WORD wKey);   /* NULL to do nothing */
+    BYTE byNext;                  /* The next CMD_STATE */
+} CMD_TRANSITION;
+
+/* A key that should do something in a state, for the self-test. */
+typedef struct
+{
+    BYTE byState;                 /* The CMD_STATE it is pressed in */
+    WORD wKey;                    /* The key */
+    void (*vAction)(WORD wKey);   /* What it should do */
+    BYTE byNext;                  /* The state it should go to */
+} CMD_EXPECTED;
+
 #define Q_SIZE 10
 
 QueueHandle_t buttonQueue;
 
 static void vButtonTask(void* pvParameters);
+static void vButtonShowTank(WORD wKey);
+static void vButtonShowTime(WORD wKey);
+static void vButtonNextPage(WORD wKey);
+static void vButtonPrevPage(WORD wKey);
+static void vButtonAckAlarm(WORD wKey);
+static void vButtonResetAll(WORD wKey);
+static void vButtonPromptPrint(WORD wKey);
+static void vButtonPrintAll(WORD wKey);
+static void vButtonPromptHist(WORD wKey);
+static void vButtonPrintHist(WORD wKey);
+static const CMD_TRANSITION* p_ctButtonCommand(BYTE byState, WORD wKey);
+
+/* The class of each key.  Keys not listed are KEY_OTHER. */
+static const BYTE a_byKeyClass[128] =
+{
+    ['1'] = KEY_TANK,
+    ['2'] = KEY_TANK,
+    ['3'] = KEY_TANK,
+    ['T'] = KEY_TIME,
+    ['G'] = KEY_PAGE,
+    ['B'] = KEY_PAGE_BACK,
+    ['R'] = KEY_RESET,
+    ['P'] = KEY_PRINT,
+    ['A'] = KEY_ALL,
+    ['H'] = KEY_HIST
+};
+
+/* The command state machine. */
+static const CMD_TRANSITION a_ctCommands[CMD_STATES][KEY_CLASSES] =
+{
+    /* CMD_NONE */
+    {
+        /* KEY_OTHER */ { NULL,               CMD_NONE },
+        /* KEY_TANK */  { vButtonShowTank,    CMD_NONE },
+        /* KEY_TIME */  { vButtonShowTime,    CMD_NONE },
+        /* KEY_PAGE */  { vButtonNextPage,    CMD_NONE },
+        /* KEY_PAGE_BACK */ { vButtonPrevPage, CMD_NONE },
+        /* KEY_RESET */ { vButtonAckAlarm,    CMD_NONE },
+        /* KEY_PRINT */ { vButtonPromptPrint, CMD_PRINT },
+        /* KEY_ALL */   { NULL,               CMD_NONE },
+        /* KEY_HIST */  { NULL,               CMD_NONE }
+    },
+    /* CMD_PRINT */
+    {
+        /* KEY_OTHER */ { NULL,               CMD_PRINT },
+        /* KEY_TANK */  { NULL,               CMD_PRINT },
+        /* KEY_TIME */  { NULL,               CMD_PRINT },
+        /* KEY_PAGE */  { NULL,               CMD_PRINT },
+        /* KEY_PAGE_BACK */ { NULL,           CMD_PRINT },
+        /* KEY_RESET */ { vButtonResetAll,    CMD_NONE },
+        /* KEY_PRINT */ { NULL,               CMD_PRINT },
+        /* KEY_ALL */   { vButtonPrintAll,    CMD_NONE },
+        /* KEY_HIST */  { vButtonPromptHist,  CMD_PRINT_HIST }
+    },
+    /* CMD_PRINT_HIST */
+    {
+        /* KEY_OTHER */ { NULL,               CMD_PRINT_HIST },
+        /* KEY_TANK */  { vButtonPrintHist,   CMD_NONE },
+        /* KEY_TIME */  { NULL,               CMD_PRINT_HIST },
+        /* KEY_PAGE */  { NULL,               CMD_PRINT_HIST },
+        /* KEY_PAGE_BACK */ { NULL,           CMD_PRINT_HIST },
+        /* KEY_RESET */ { vButtonResetAll,    CMD_NONE },
+        /* KEY_PRINT */ { NULL,               CMD_PRINT_HIST },
+        /* KEY_ALL */   { NULL,               CMD_PRINT_HIST },
+        /* KEY_HIST */  { NULL,               CMD_PRINT_HIST }
+    }
+};
 
 void vButtonSystemInit(void) {
     buttonQueue = xQueueCreate(Q_SIZE, sizeof(WORD));
@@ -44,81 +142,141 @@ void vButtonSystemInit(void) {
 static void vButtonTask(void* pvParameters) {
     
     WORD wMsg;
-    enum CMD_STATE iCmdState;
+    BYTE byState;
+    const CMD_TRANSITION* p_ct;
     
     /* Prevent the compiler warning about the unused parameter. */
     (void)pvParameters;
 
-    iCmdState = CMD_NONE;
+    byState = CMD_NONE;
 
     for (;;) {
         xQueueReceive(buttonQueue, &wMsg, portMAX_DELAY);
 
-        switch (iCmdState) {
-            case CMD_NONE:
-                switch (wMsg)
-                {
-                    case '1':
-                    case '2':
-                    case '3':
-                        vDisplayTankLevel(wMsg - '1');
-                        break;
-
-                    case 'T':
-                        //printf("Reached button task");
-                        //while (TRUE);
-                        vDisplayTime();
-                        break;
-                    case 'R':
-                        vHardwareBellOff();
-                        vDisplayResetAlarm();
-                        break;
-
-                    case 'P':
-                        iCmdState = CMD_PRINT;
-                        vDisplayPrompt(0);
-                        break;
-                }
-            case CMD_PRINT:
-                switch (wMsg)
-                {
-                case 'R':
-                    iCmdState = CMD_NONE;
-                    vHardwareBellOff();
-                    vDisplayResetAlarm();
-                    break;
-
-                case 'A':
-                    vPrintAll();
-                    iCmdState = CMD_NONE;
-                    vDisplayNoPrompt();
-                    break;
-
-                case 'H':
-                    iCmdState = CMD_PRINT_HIST;
-                    vDisplayPrompt(1);
-                    break;
-                }
-                break;
-
-            case CMD_PRINT_HIST:
-                switch (wMsg)
-                {
-                case 'R':
-                    iCmdState = CMD_NONE;
-                    vHardwareBellOff();
-                    vDisplayResetAlarm();
-                    break;
-
-                case '1':
-                case '2':
-                case '3':
-                    vPrintTankHistory(wMsg - '1');
-                    iCmdState = CMD_NONE;
-                    vDisplayNoPrompt();
-                    break;
+        /* Look up what to do with this key */
+        p_ct = p_ctButtonCommand(byState, wMsg);
+
+        if (p_ct->vAction != NULL)
+            p_ct->vAction(wMsg);
+        byState = p_ct->byNext;
+    }
+}
+
+/* Finds what to do with a key in a state. */
+static const CMD_TRANSITION* p_ctButtonCommand(BYTE byState, WORD wKey) {
+    if (wKey < sizeof(a_byKeyClass))
+        return (&a_ctCommands[byState][a_byKeyClass[wKey]]);
+    return (&a_ctCommands[byState][KEY_OTHER]);
+}
+
+/* The actions of the command state machine */
+static void vButtonShowTank(WORD wKey) {
+    vDisplayTankLevel(wKey - '1');
+}
+
+static void vButtonShowTime(WORD wKey) {
+    (void)wKey;
+    vDisplayTime();
+}
+
+static void vButtonNextPage(WORD wKey) {
+    (void)wKey;
+    vDisplayNextPage();
+}
+
+static void vButtonPrevPage(WORD wKey) {
+    (void)wKey;
+    vDisplayPrevPage();
+}
+
+static void vButtonAckAlarm(WORD wKey) {
+    (void)wKey;
+    vDisplayResetAlarm(DISP_ALARM_CURRENT);
+}
+
+static void vButtonResetAll(WORD wKey) {
+    (void)wKey;
+    vDisplayResetAlarm(DISP_ALARM_ALL);
+}
+
+static void vButtonPromptPrint(WORD wKey) {
+    (void)wKey;
+    vDisplayPrompt(0);
+}
+
+static void vButtonPrintAll(WORD wKey) {
+    (void)wKey;
+    vPrintAll();
+    vDisplayNoPrompt();
+}
+
+static void vButtonPromptHist(WORD wKey) {
+    (void)wKey;
+    vDisplayPrompt(1);
+}
+
+static void vButtonPrintHist(WORD wKey) {
+    vPrintTankHistory(wKey - '1');
+    vDisplayNoPrompt();
+}
+
+/* What every key should do, written out key by key rather than by
+   class so that it does not share the table's mistakes.  A key not
+   listed for a state should do nothing and leave the state alone.
+   This differs from the switch in the original code on purpose: a
+   key pressed with no prompt no longer falls through to the print
+   prompt's keys, 'G' and 'B' page the display forward and back, and 'R' with no prompt only
+   acknowledges the alarm shown. */
+static const CMD_EXPECTED a_ceExpected[] =
+{
+    { CMD_NONE,       '1', vButtonShowTank,    CMD_NONE },
+    { CMD_NONE,       '2', vButtonShowTank,    CMD_NONE },
+    { CMD_NONE,       '3', vButtonShowTank,    CMD_NONE },
+    { CMD_NONE,       'T', vButtonShowTime,    CMD_NONE },
+    { CMD_NONE,       'G', vButtonNextPage,    CMD_NONE },
+    { CMD_NONE,       'B', vButtonPrevPage,    CMD_NONE },
+    { CMD_NONE,       'R', vButtonAckAlarm,    CMD_NONE },
+    { CMD_NONE,       'P', vButtonPromptPrint, CMD_PRINT },
+    { CMD_PRINT,      'R', vButtonResetAll,    CMD_NONE },
+    { CMD_PRINT,      'A', vButtonPrintAll,    CMD_NONE },
+    { CMD_PRINT,      'H', vButtonPromptHist,  CMD_PRINT_HIST },
+    { CMD_PRINT_HIST, 'R', vButtonResetAll,    CMD_NONE },
+    { CMD_PRINT_HIST, '1', vButtonPrintHist,   CMD_NONE },
+    { CMD_PRINT_HIST, '2', vButtonPrintHist,   CMD_NONE },
+    { CMD_PRINT_HIST, '3', vButtonPrintHist,   CMD_NONE }
+};
+
+/* Checks the command table against the list of what each key should
+   do, for every state and every key a WORD can hold. */
+void vButtonSelfTest(SELF_TEST* p_st) {
+    CMD_TRANSITION ctExpected;
+    const CMD_TRANSITION* p_ct;
+    BYTE byState;
+    unsigned long ulKey;
+    int i;
+
+    p_st->ulCases = 0;
+    p_st->ulFailures = 0;
+    p_st->ullMicroseconds = 0;
+    p_st->ullBaseline = 0;
+
+    for (byState = 0; byState < CMD_STATES; ++byState) {
+        for (ulKey = 0; ulKey <= 0xFFFF; ++ulKey) {
+            p_ct = p_ctButtonCommand(byState, (WORD)ulKey);
+
+            /* Nothing, unless the list says otherwise */
+            ctExpected.vAction = NULL;
+            ctExpected.byNext = byState;
+            for (i = 0; i < (int)(sizeof(a_ceExpected) / sizeof(a_ceExpected[0])); ++i) {
+                if (a_ceExpected[i].byState == byState && a_ceExpected[i].wKey == ulKey) {
+                    ctExpected.vAction = a_ceExpected[i].vAction;
+                    ctExpected.byNext = a_ceExpected[i].byNext;
                 }
-                break;
+            }
+
+            ++p_st->ulCases;
+            if (p_ct->vAction != ctExpected.vAction || p_ct->byNext != ctExpected.byNext)
+                ++p_st->ulFailures;
         }
     }
 }
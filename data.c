@@ -8,8 +8,7 @@ This module stores the tank data.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include "tankport.h"
 #include "assert.h"
 
 /* Kernel includes. */
@@ -20,7 +19,6 @@ This module stores the tank data.
 #include "publics.h"
 
 /* Local Defines */
-#define HISTORY_DEPTH 8
 #define WAIT_FOREVER 0
 
 /* Local Structures */
@@ -28,8 +26,10 @@ typedef struct
 {
     int a_iLevel[HISTORY_DEPTH];  /* Tank level */
     int aa_iTime[HISTORY_DEPTH][4]; /* Time level was measured */
+    unsigned long long a_ullTick[HISTORY_DEPTH]; /* The same, in 1/3-second ticks since the start */
     int iCurrent;  /* Index to most recent entry */
     BOOL fFull;  /* TRUE if all history entries have data */
+    unsigned long ulCount;  /* Entries ever added; entry n is in slot n % HISTORY_DEPTH */
 } TANK_DATA;
 
 /* Static Data */
@@ -37,6 +37,9 @@ typedef struct
 /* Data about each of the tanks */
 static TANK_DATA a_td[COUNTOF_TANKS];
 
+/* Entries ever added, for all the tanks together */
+static unsigned long ulGeneration;
+
 SemaphoreHandle_t xSemData;
 
 void vTankDataInit(void) {
@@ -47,6 +50,7 @@ void vTankDataInit(void) {
     {
         a_td[iTank].iCurrent = -1;
         a_td[iTank].fFull = FALSE;
+        a_td[iTank].ulCount = 0;
     }
 
     /* Initialize the semaphore that protects the data */
@@ -70,14 +74,17 @@ void vTankDataAdd(int iTank, int iLevel) {
 
     /* Put the data in place */
     a_td[iTank].a_iLevel[a_td[iTank].iCurrent] = iLevel;
+    a_td[iTank].a_ullTick[a_td[iTank].iCurrent] = ullTimeNowTicks();
     vTimeGet(a_td[iTank].aa_iTime[a_td[iTank].iCurrent]);
+    ++a_td[iTank].ulCount;
+    ++ulGeneration;
 
     xSemaphoreGive(xSemData);
 
     vDisplayUpdate();
 }
 
-int iTankDataGet(int iTank, int* a_iLevels, int** aa_iTimes, int iLimit) {
+int iTankDataGet(int iTank, int* a_iLevels, int* aa_iTimes, int iLimit) {
     int iReturn;
     int iIndex;
 
@@ -124,4 +131,126 @@ int iTankDataGet(int iTank, int* a_iLevels, int** aa_iTimes, int iLimit) {
     xSemaphoreGive(xSemData);
 
     return(iReturn);
-}
\ No newline at end of file
+}
+
+/* Gets the ticks at which up to iLimit of a tank's latest entries
+   were added, newest first, in the same order as iTankDataGet.
+   Unlike the time of day, these do not wrap at midnight.  Returns
+   the number of entries. */
+int iTankDataGetTicks(int iTank, unsigned long long* a_ullTicks, int iLimit) {
+    int iReturn;
+    int iIndex;
+
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+    assert(a_ullTicks != NULL);
+    assert(iLimit > 0);
+
+    iReturn = 0;
+
+    if (iLimit > HISTORY_DEPTH)
+        iLimit = HISTORY_DEPTH;
+
+    xSemaphoreTake(xSemData, portMAX_DELAY);
+
+    iIndex = a_td[iTank].iCurrent;
+
+    while (iIndex >= 0 && iReturn < iLimit)
+    {
+        a_ullTicks[iReturn] = a_td[iTank].a_ullTick[iIndex];
+        ++iReturn;
+
+        /* Find the next oldest element, wrapping as iTankDataGet does */
+        --iIndex;
+        if (iIndex == -1 && a_td[iTank].fFull)
+            iIndex = HISTORY_DEPTH - 1;
+    }
+
+    xSemaphoreGive(xSemData);
+
+    return(iReturn);
+}
+
+/* Gets the latest level of iCount tanks starting at iFirst, all under
+   one hold of the semaphore.  Tanks with no readings get TANK_NO_LEVEL.
+   Returns the number of tanks, which is less than iCount if the run
+   goes past the last tank. */
+int iTankDataGetLatest(int iFirst, int iCount, int* a_iLevels) {
+    int iTank;
+
+    assert(iFirst >= 0 && iFirst < COUNTOF_TANKS);
+    assert(a_iLevels != NULL);
+    assert(iCount > 0);
+
+    if (iCount > COUNTOF_TANKS - iFirst)
+        iCount = COUNTOF_TANKS - iFirst;
+
+    xSemaphoreTake(xSemData, portMAX_DELAY);
+
+    for (iTank = 0; iTank < iCount; ++iTank)
+    {
+        if (a_td[iFirst + iTank].iCurrent >= 0)
+            a_iLevels[iTank] = a_td[iFirst + iTank].a_iLevel[a_td[iFirst + iTank].iCurrent];
+        else
+            a_iLevels[iTank] = TANK_NO_LEVEL;
+    }
+
+    xSemaphoreGive(xSemData);
+
+    return(iCount);
+}
+
+/* Returns the number of entries ever added for a tank.  Entries are
+   numbered from 0 in the order they were added; only the last
+   HISTORY_DEPTH of them are kept. */
+unsigned long ulTankDataCount(int iTank) {
+    unsigned long ulCount;
+
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    xSemaphoreTake(xSemData, portMAX_DELAY);
+    ulCount = a_td[iTank].ulCount;
+    xSemaphoreGive(xSemData);
+
+    return(ulCount);
+}
+
+/* Returns the number of entries ever added for all the tanks together,
+   so that a caller can tell whether anything at all has changed */
+unsigned long ulTankDataGeneration(void) {
+    unsigned long ulReturn;
+
+    xSemaphoreTake(xSemData, portMAX_DELAY);
+    ulReturn = ulGeneration;
+    xSemaphoreGive(xSemData);
+
+    return(ulReturn);
+}
+
+/* Gets entry ulEntry of a tank's history, so that a caller can walk
+   the history one entry at a time.  Returns FALSE if the entry has
+   not been added yet or has already been overwritten. */
+BOOL fTankDataGetEntry(int iTank, unsigned long ulEntry, int* p_iLevel, int* a_iTime) {
+    BOOL fReturn;
+    int iIndex;
+
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+    assert(p_iLevel != NULL && a_iTime != NULL);
+
+    xSemaphoreTake(xSemData, portMAX_DELAY);
+
+    fReturn = ulEntry < a_td[iTank].ulCount &&
+        a_td[iTank].ulCount - ulEntry <= HISTORY_DEPTH;
+    if (fReturn)
+    {
+        iIndex = (int)(ulEntry % HISTORY_DEPTH);
+        *p_iLevel = a_td[iTank].a_iLevel[iIndex];
+        a_iTime[0] = a_td[iTank].aa_iTime[iIndex][0];
+        a_iTime[1] = a_td[iTank].aa_iTime[iIndex][1];
+        a_iTime[2] = a_td[iTank].aa_iTime[iIndex][2];
+        a_iTime[3] = a_td[iTank].aa_iTime[iIndex][3];
+    }
+
+    xSemaphoreGive(xSemData);
+
+    return(fReturn);
+}
@@ -83,8 +83,9 @@
 
   /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "tankport.h"
 #include <assert.h>
 
 /* Kernel includes. */
@@ -130,7 +131,24 @@
 #define DBG_SCRN_BELL_WIDTH     10
 #define DBG_SCRN_BELL_HEIGHT    3
 
-/* Line drawing characters for text mode */
+/* The part of the console the simulation draws on; the statistics
+   go below it */
+#define DBG_SCRN_WIDTH          80
+#define DBG_SCRN_HEIGHT         27
+
+/* Commands to the renderer task */
+#define DBG_DRAW_DISPLAY        0   /* Display text from sColumn; all of it if byArg */
+#define DBG_DRAW_BELL           1   /* The bell, on if byArg is TRUE */
+#define DBG_DRAW_PRINTER        2   /* A line out of the printer */
+#define DBG_DRAW_BUTTON         3   /* Button sRow, sColumn, on byArg */
+#define DBG_DRAW_AUTOTIME       4   /* Whether time passes by itself */
+#define DBG_DRAW_FLOATS         5   /* The float levels */
+#define DBG_DRAW_SPEED          6   /* The speed of the hardware */
+#define DBG_DRAW_SLOTS          256 /* Commands waiting at most; a power of 2 */
+
+/* Line drawing characters for text mode.  A terminal elsewhere
+   may not have the PC character set, so draw with plain ASCII. */
+#if defined(_WIN32)
 #define LINE_HORIZ              196
 #define LINE_VERT               179
 #define LINE_CORNER_NW          218
@@ -142,10 +160,56 @@
 #define LINE_T_E                180
 #define LINE_T_S                193
 #define LINE_CROSS              197
+#else
+#define LINE_HORIZ              '-'
+#define LINE_VERT               '|'
+#define LINE_CORNER_NW          '+'
+#define LINE_CORNER_NE          '+'
+#define LINE_CORNER_SE          '+'
+#define LINE_CORNER_SW          '+'
+#define LINE_T_W                '+'
+#define LINE_T_N                '+'
+#define LINE_T_E                '+'
+#define LINE_T_S                '+'
+#define LINE_CROSS              '+'
+#endif
 
 /* Scalers for FreeRTOS Simulation */
 #define X_SIMULATION_SCALER 1
 
+/* Keystroke injection */
+#define INJECT_OUT_DISPLAY      0x01    /* The key should change the display */
+#define INJECT_OUT_PRINT        0x02    /* The key should start a printout */
+#define INJECT_RATES            2       /* Gaps between keys to try */
+#define INJECT_RUNS             (INJECT_RATES * 2)  /* Each without and with load */
+#define INJECT_PASSES           3       /* Times through the script in a run */
+#define INJECT_TIMEOUT_US       10000000ULL         /* Longest wait for output */
+#define INJECT_PENDING          64      /* Presses waiting for output at most */
+#define INJECT_DRAIN_POLL       pdMS_TO_TICKS(10)   /* After the last press, look this often */
+#define INJECT_LOAD_BUSY        pdMS_TO_TICKS(5)   /* Background load spins... */
+#define INJECT_LOAD_IDLE        pdMS_TO_TICKS(5)   /* ...then rests */
+
+/* Simulated printer */
+#define DBG_PRINTER_LINES_PER_SECOND   2
+#define DBG_PRINTER_BUFFER_LINES       4
+
+/* Timing of the simulated hardware */
+#define DBG_BTN_BLINK_TIME      pdMS_TO_TICKS(185)  /* A pressed button stays red */
+#define DBG_BTN_BLINK_RETRY     pdMS_TO_TICKS(10)   /* Wait if the screen is busy */
+#define DBG_FLOAT_LATENCY       pdMS_TO_TICKS(100)  /* Floats answer on their own */
+#define DBG_FLAT_OUT_TICKS      300                 /* Most ticks per pass flat out */
+#define DBG_SCALES              4                   /* Speeds 'S' steps through */
+
+/* A repeatable run from a seed, instead of the keyboard, when the
+   environment has TANK_SIM_SEED in it */
+#define DBG_SIM_SECONDS         3600                /* Unless TANK_SIM_SECONDS says */
+#define DBG_SIM_TRACE           "simtrace.txt"      /* Unless TANK_SIM_TRACE says */
+
+/* What TANK_SELFTEST runs */
+#define DBG_TEST_OFLOW_TANKS    100000              /* Tanks for the overflow wheel... */
+#define DBG_TEST_OFLOW_FEW      1000                /* ...a few of them watched */
+#define DBG_TEST_ALARM_TANKS    10000               /* Tanks for the alarm scan */
+
 /* Color values for display */
 #define BLACK 0x0000
 #define BLUE 0x0001
@@ -156,26 +220,116 @@
 /* Static Data */
 
 /* Data for displaying and getting buttons */
-#define BUTTON_ROWS             3
+#define BUTTON_ROWS             4
 #define BUTTON_COLUMNS          3
 
 // Declares arrays of buttons
 static char* p_chButtonText[BUTTON_ROWS][BUTTON_COLUMNS] =
 {
     {" PRT ", " 1 ", " TIME "},
-    {" HST ", " 2 ", NULL},
-    {" ALL ", " 3 ", " RST "}
+    {" HST ", " 2 ", " PAGE "},
+    {" ALL ", " 3 ", " RST "},
+    {NULL, NULL, " BACK "}
 };
 
 static char a_chButtonKey[BUTTON_ROWS][BUTTON_COLUMNS] =
 {
     {'P', '1', 'T'},
-    {'H', '2', '\x00'},
-    {'A', '3', 'R'}
+    {'H', '2', 'G'},
+    {'A', '3', 'R'},
+    {'\0', '\0', 'B'}
 };
 
 /* Console handle for global use in display */
+#if defined(_WIN32)
 static HANDLE hConsole;
+#endif
+
+/* TRUE to draw nothing, and instead write what the display, the
+   printer and the bell do to stdout, one line each.  Set when the
+   environment has TANK_HEADLESS in it. */
+static BOOL fHeadless = FALSE;
+
+/* What the display shows, for the headless log */
+static char a_chDisplayShown[DBG_SCRN_DISP_WIDTH + 1];
+
+/* One character cell of the screen */
+typedef struct
+{
+    char ch;        /* The character */
+    BYTE byColor;   /* Its background color */
+} DBG_CELL;
+
+/* The screen as drawn, and as the console last showed it.  Drawing
+   only changes aa_cellDrawn; vUtilityFlush() sends the console the
+   cells that differ, a frame at a time. */
+static DBG_CELL aa_cellDrawn[DBG_SCRN_HEIGHT][DBG_SCRN_WIDTH];
+static DBG_CELL aa_cellShown[DBG_SCRN_HEIGHT][DBG_SCRN_WIDTH];
+
+/* Where the next drawing goes, and on what color */
+static int iDrawX = 0;
+static int iDrawY = 0;
+static BYTE byDrawColor = BLACK;
+
+#if defined(_WIN32)
+/* The console's text color, and a frame in the console's own form */
+static WORD wConsoleText = 0x07;
+static CHAR_INFO a_ciFrame[DBG_SCRN_HEIGHT * DBG_SCRN_WIDTH];
+#else
+/* Where the terminal's cursor is and what color it is using, or -1
+   when not known, and room for a frame of escape sequences */
+static int iShownX = -1;
+static int iShownY = -1;
+static int iShownColor = -1;
+static char a_chFrame[DBG_SCRN_HEIGHT * DBG_SCRN_WIDTH * 16];
+#endif
+
+/* A command to the renderer task */
+typedef struct
+{
+    BYTE byOp;          /* DBG_DRAW_ */
+    BYTE byArg;         /* On or off, or a color */
+    short sRow;         /* Where, for a button */
+    short sColumn;      /* Where, for a button or the display */
+    int a_iTime[4];     /* When, for the headless log */
+    char a_chText[DBG_SCRN_PRNTR_WIDTH + 1];  /* For the display or the printer */
+} DBG_DRAW;
+
+/* The commands waiting for the renderer.  Any task, or the keyboard
+   handler, claims a slot by moving lDrawHead on, fills it, then
+   sets its lSeq to one past its position to hand it over; the
+   renderer empties it and sets lSeq a lap on to hand it back.  No
+   one waits on a lock, so no one draws while holding one. */
+typedef struct
+{
+    volatile LONG lSeq;
+    DBG_DRAW dd;
+} DBG_DRAW_SLOT;
+
+static DBG_DRAW_SLOT a_dsDraw[DBG_DRAW_SLOTS];
+static volatile LONG lDrawHead = 0;  /* The next slot to claim */
+static LONG lDrawTail = 0;           /* The next slot to render */
+
+/* The renderer, and whether it should end the program once it has
+   drawn what is waiting */
+static TaskHandle_t xRenderTask = NULL;
+static volatile BOOL fDebugExit = FALSE;
+
+/* Commands handed over, waits for a free slot, and commands dropped
+   because the keyboard handler cannot wait.  Tasks and the keyboard
+   handler all count into these, so only with interlocked operations. */
+static volatile LONG lDrawPosted = 0;
+static volatile LONG lDrawWaits = 0;
+static volatile LONG lDrawDropped = 0;
+
+/* Drawing calls, each of which used to go to the console by itself;
+   frames, each one write; cells sent; how long each frame took to
+   work out and write, in microseconds; and since when */
+static unsigned long ulScreenCalls = 0;
+static unsigned long ulScreenFrames = 0;
+static unsigned long ulScreenCells = 0;
+static STATS_HIST shScreenFrame;
+static unsigned long long ullScreenSince;
 
 /* Button the user pressed. */
 static WORD wButton;
@@ -185,8 +339,31 @@ static WORD wButton;
 static char aa_charPrinted
 [DBG_SCRN_PRNTR_HEIGHT][DBG_SCRN_PRNTR_WIDTH + 1];
 
-/* Printing a line now. */
-static int iPrinting = 0;
+/* The simulated printer prints this many lines a second... */
+static int iPrinterLinesPerSecond = DBG_PRINTER_LINES_PER_SECOND;
+
+/* ...and takes at most this many at a time. */
+static int iPrinterBufferLines = DBG_PRINTER_BUFFER_LINES;
+
+/* Goes off when the printer finishes a batch. */
+static TimerHandle_t xPrinterTimer;
+
+/* When the printer should finish its batch, in microseconds */
+static unsigned long long ullPrinterDueAt;
+
+/* Goes off when a pressed button should stop blinking. */
+static TimerHandle_t xBlinkTimer;
+
+/* How far each 1/3-second tick was from its exact third of a
+   second, and how late the printer finished each batch, in
+   microseconds.  Ticks are only measured at real speed. */
+static STATS_HIST shTickJitter;
+static STATS_HIST shPrinterLate;
+
+/* Ticks measured, and how far they were behind (or ahead of) time
+   altogether, in microseconds */
+static unsigned long ulTicksMeasured = 0;
+static long long llTickDrift = 0;
 
 /* Boolean that tracks if a button has been pressed */
 static BOOL fBtnFound = FALSE;
@@ -208,15 +385,116 @@ static int iTankChanging = 0;
 /* Is time passing automatically? */
 static BOOL fAutoTime = FALSE;
 
-static void vDebugAdditionalTasks(void* pvParameters);
+/* Speeds of the simulated hardware, and which one it runs at */
+static const int a_iScales[DBG_SCALES] = { 1, 10, 1000, TIMER_SCALE_MAX };
+static int iScaleChosen = 0;
+
+/* Goes off when the floats answer, while time passes automatically.
+   Faster than real speed, they answer with the next 1/3-second tick
+   instead, once this is set. */
+static TimerHandle_t xFloatsTimer;
+static volatile BOOL fFloatsDue = FALSE;
+
+/* Keystroke injection.  Each step of the script presses a button
+   and says what the display and the printer should then show: the
+   display line must start with p_chDisplay, and a printed line must
+   be p_chPrint, where '#' stands for any digit.  Every step changes
+   the display, and every pass through the script leaves the command
+   software where it started. */
+typedef struct
+{
+    char chKey;              /* The button */
+    const char* p_chDisplay; /* What the display should show */
+    const char* p_chPrint;   /* A line it should print, or NULL */
+} INJECT_STEP;
+
+static const INJECT_STEP a_isScript[] =
+{
+    { '1', "Tank 1:", NULL },
+    { '2', "Tank 2:", NULL },
+    { '3', "Tank 3:", NULL },
+    { 'G', "1:", NULL },
+    { 'T', "##:##:##", NULL },
+    { 'P', "Press: HST or ALL", NULL },
+    { 'A', "##:##:##", "Time: ##:##:##" },
+    { 'P', "Press: HST or ALL", NULL },
+    { 'H', "Press Tank Number", NULL },
+    { '1', "##:##:##", "Tank 1" }
+};
+
+/* A press that has not yet caused all of its output */
+typedef struct
+{
+    unsigned long long ullAt;   /* When it was due to be pressed */
+    const INJECT_STEP* p_is;    /* What it should cause */
+    BYTE byWaiting;             /* INJECT_OUT_ bits still to come */
+} INJECT_PRESS;
+
+/* Time between presses; they go in on this clock, whether or not
+   the output of the ones before has come out */
+static const TickType_t a_xInjectGap[INJECT_RATES] =
+{
+    pdMS_TO_TICKS(200),
+    pdMS_TO_TICKS(20)
+};
+
+/* Button-to-display and button-to-print latency, in microseconds,
+   keys that never got their output, and keys whose output was
+   overtaken by that of a later key, for each run */
+static STATS_HIST a_shInjectDisplay[INJECT_RUNS];
+static STATS_HIST a_shInjectPrint[INJECT_RUNS];
+static unsigned long a_ulInjectMissed[INJECT_RUNS];
+static unsigned long a_ulInjectOvertaken[INJECT_RUNS];
+
+/* Runs finished so far */
+static int iInjectRunsDone = 0;
+
+/* The run going on, and its presses that are still waiting for
+   output, oldest first */
+static int iInjectRun;
+static INJECT_PRESS a_ipInject[INJECT_PENDING];
+static int iInjectOldest = 0;
+static int iInjectWaiting = 0;
+
+/* What the display is showing, for matching against the script */
+static char a_chInjectShown[DBG_SCRN_DISP_WIDTH + 1];
+
+/* The injection task, whether it is running, and whether the load
+   task should be busy */
+static TaskHandle_t xInjectTask = NULL;
+static volatile BOOL fInjecting = FALSE;
+static volatile BOOL fInjectLoad = FALSE;
+
 static void vDebugTimerTask(void* pvParameters);
-static SemaphoreHandle_t xWinSem;
+static void vDebugInjectTask(void* pvParameters);
+static void vDebugLoadTask(void* pvParameters);
+static void vDebugPrinterDone(TimerHandle_t xTimer);
+static void vDebugUnblink(TimerHandle_t xTimer);
+static void vDebugFloatsDone(TimerHandle_t xTimer);
+static void vDebugFloatsTick(void);
+static void vDebugRenderTask(void* pvParameters);
+static void vDebugDraw(DBG_DRAW* p_dd, BOOL fMayWait);
+static BOOL fDebugDrawPost(const DBG_DRAW* p_dd);
+static BOOL fDebugDrawTake(DBG_DRAW* p_dd);
 
 
 /* Static Functions */
 static void vUtilityDrawBox(int ixNW, int iyNW, int iXSize, int iYSize);
 static void vUtilityDisplayFloatLevels(void);
 static void vUtilityPrinterDisplay(void);
+static void vUtilityDisplaySpeed(void);
+static void vUtilityRender(const DBG_DRAW* p_dd);
+static void vDebugReportStats(void);
+static void vDebugSelfTest(void);
+static unsigned long ulDebugSelfTestReport(const char* p_chWhat, const char* p_chBaseline, const SELF_TEST* p_st);
+static void vDebugInjectSeen(BYTE byOutput, const char* p_chText);
+static BOOL fDebugInjectMatch(const char* p_chPattern, const char* p_chText, BOOL fWhole);
+static void vDebugInjectExpire(unsigned long long ullNow, BOOL fAll);
+static void vUtilityDraw(const char* p_chFormat, ...);
+static void vUtilityLog(const char* p_chWhat, const char* p_chText, const int* a_iTime);
+static void vUtilityClearScreen(void);
+static void vUtilityFlush(void);
+static void vUtilityEndScreen(void);
 static void gotoxy(int x, int y);
 static void setTextBackgroundColor(int bgColor);
 static void hideCursor(void);
@@ -225,9 +503,19 @@ static void hideCursor(void);
 
 void dbgmain(void)
 {
+    char* p_chSeed;
+    char* p_chSeconds;
+    char* p_chTrace;
+    BOOL fSelfTest;
+
+    /* A self-test prints its results and never draws the screen. */
+    fSelfTest = getenv("TANK_SELFTEST") != NULL;
+    fHeadless = fSelfTest || getenv("TANK_HEADLESS") != NULL;
+
     /* Initialize System Components */
     vTankDataInit();
     vTimerInit();
+    vAlarmSystemInit();
     vDisplaySystemInit();
     vFloatInit();
     vButtonSystemInit();
@@ -236,6 +524,21 @@ void dbgmain(void)
     vHardwareInit();
     vOverflowSystemInit();
 
+    /* Check the modules and time them against the old ways, if asked to. */
+    if (fSelfTest)
+        vDebugSelfTest();
+
+    /* Let the simulation drive the hardware, if asked to. */
+    p_chSeed = getenv("TANK_SIM_SEED");
+    if (p_chSeed != NULL)
+    {
+        p_chSeconds = getenv("TANK_SIM_SECONDS");
+        p_chTrace = getenv("TANK_SIM_TRACE");
+        vSimInit(strtoul(p_chSeed, NULL, 10),
+            p_chSeconds != NULL ? strtoul(p_chSeconds, NULL, 10) : DBG_SIM_SECONDS,
+            p_chTrace != NULL ? p_chTrace : DBG_SIM_TRACE);
+    }
+
     /* Start OS */
     vTaskStartScheduler();
 
@@ -246,20 +549,42 @@ void dbgmain(void)
 
 void vHardwareInit(void) {
     int iColumn, iRow; /* Iterators */
-    BYTE byErr; /* May not be necessary, used in micro c semaphore pending function*/
+
+#if defined(_WIN32)
+    CONSOLE_SCREEN_BUFFER_INFO consoleInfo;
 
     hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 
-    xWinSem = xSemaphoreCreateBinary();
-    xSemaphoreGive(xWinSem);
+    /* Draw in whatever text color the console started with */
+    if (GetConsoleScreenBufferInfo(hConsole, &consoleInfo))
+        wConsoleText = consoleInfo.wAttributes & 0x0F;
+#endif
 
-    configASSERT(xWinSem != NULL);
+    /* Every slot starts empty, waiting for its first lap. */
+    for (iRow = 0; iRow < DBG_DRAW_SLOTS; ++iRow)
+        a_dsDraw[iRow].lSeq = iRow;
+    xTaskCreate(vDebugRenderTask, "dbrender", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DEBUG_RENDER, &xRenderTask);
+    configASSERT(xRenderTask != NULL);
 
     /* Start the debugging tasks */
     xTaskCreate(vDebugTimerTask, "dbtimer", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DEBUG_TIMER, NULL);
     //xTaskCreate(vDebugAdditionalTasks, "dbtasks", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DEBUG_ADD, NULL);
-
-    system("cls");
+    xPrinterTimer = xTimerCreate("dbprinter", 1, pdFALSE, NULL, vDebugPrinterDone);
+    configASSERT(xPrinterTimer != NULL);
+    xBlinkTimer = xTimerCreate("dbblink", DBG_BTN_BLINK_TIME, pdFALSE, NULL, vDebugUnblink);
+    configASSERT(xBlinkTimer != NULL);
+    xFloatsTimer = xTimerCreate("dbfloats", DBG_FLOAT_LATENCY, pdFALSE, NULL, vDebugFloatsDone);
+    configASSERT(xFloatsTimer != NULL);
+    iTimerRegister(vDebugFloatsTick, 1, TRUE);
+    vStatsHistInit(&shTickJitter);
+    vStatsHistInit(&shPrinterLate);
+    vStatsHistInit(&shScreenFrame);
+    ullScreenSince = ullStatsMicroseconds();
+
+    xTaskCreate(vDebugInjectTask, "dbinject", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DEBUG_INJECT, &xInjectTask);
+    xTaskCreate(vDebugLoadTask, "dbload", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DEBUG_LOAD, NULL);
+
+    vUtilityClearScreen();
     hideCursor();
 
     /* Divide the screen */
@@ -267,67 +592,72 @@ void vHardwareInit(void) {
     {
         gotoxy(DBG_SCRN_DIV_X, iRow);
         // DBG_SCRN_DIV_X == x, iRow == y
-        printf("%c", LINE_VERT); // Prints a '|' at each location
+        vUtilityDraw("%c", LINE_VERT); // Prints a '|' at each location
     }
     /* Set up the debug side of the screen */
     gotoxy(7, 2);
-    printf(" D E B U G ");
+    vUtilityDraw(" D E B U G ");
 
     gotoxy(1, 4);
-    printf("These keys press buttons:");
+    vUtilityDraw("These keys press buttons:");
 
     gotoxy(1, 5);
-    printf(" P  1  T");
+    vUtilityDraw(" P  1  T");
 
     gotoxy(1, 6);
-    printf(" H  2");
+    vUtilityDraw(" H  2  G");
 
     /* More UI setup */
     gotoxy(1, 7);
-    printf(" A  3  R");
+    vUtilityDraw(" A  3  R");
+
+    gotoxy(1, 8);
+    vUtilityDraw("'K' time keys, 'C' cancel print");
 
     gotoxy(1, 9);
-    printf("Press 'X' to exit the program");
+    vUtilityDraw("Press 'X' to exit the program");
 
     gotoxy(1, 10);
-    printf("-------------------------");
+    vUtilityDraw("-------------------------");
 
     gotoxy(1, DBG_SCRN_TIME_ROW - 1);
-    printf("TIME:");
+    vUtilityDraw("TIME:");
 
     gotoxy(1, DBG_SCRN_TIME_ROW);
-    printf(" '/' to make 1/3 second pass");
+    vUtilityDraw(" '/' to make 1/3 second pass");
 
     gotoxy(1, DBG_SCRN_TIME_ROW + 1);
-    printf(" 'O' to toggle auto timer");
+    vUtilityDraw(" 'O' to toggle auto timer");
+
+    vUtilityDisplaySpeed();
 
     gotoxy(1, DBG_SCRN_TIME_ROW + 3);
-    printf("Auto-time is:");
+    vUtilityDraw("Auto-time is:");
 
     gotoxy(15, DBG_SCRN_TIME_ROW + 3);
     setTextBackgroundColor(RED); // Borland C compiler function, sets background color of subsequently printed text
     // i.e OFF button will now have a red background
-    printf(" OFF ");
+    vUtilityDraw(" OFF ");
     setTextBackgroundColor(BLACK); // Resets background color to black
 
     gotoxy(1, DBG_SCRN_TIME_ROW + 4);
-    printf("-------------------------");
+    vUtilityDraw("-------------------------");
 
     /* Display the current tank levels */
     gotoxy(1, DBG_SCRN_FLOAT_ROW - 4);
-    printf("FLOATS:");
+    vUtilityDraw("FLOATS:");
 
     gotoxy(1, DBG_SCRN_FLOAT_ROW - 3);
-    printf(" '<' and '>' to select float");
+    vUtilityDraw(" '<' and '>' to select float");
 
     gotoxy(1, DBG_SCRN_FLOAT_ROW - 2);
-    printf(" '+' and '-' to change level");
+    vUtilityDraw(" '+' and '-' to change level");
 
     gotoxy(1, DBG_SCRN_FLOAT_ROW);
-    printf("Tank:");
+    vUtilityDraw("Tank:");
 
     gotoxy(1, DBG_SCRN_FLOAT_ROW + 2);
-    printf("Level");
+    vUtilityDraw("Level");
 
     vUtilityDisplayFloatLevels();
 
@@ -340,14 +670,14 @@ void vHardwareInit(void) {
             {
                 gotoxy(DBG_SCRN_BTN_X + iColumn * DBG_SCRN_BTN_WIDTH,
                     DBG_SCRN_BTN_Y + iRow * DBG_SCRN_BTN_HEIGHT);
-                printf("%s", p_chButtonText[iRow][iColumn]);
+                vUtilityDraw("%s", p_chButtonText[iRow][iColumn]);
             }
         }
     setTextBackgroundColor(BLACK);
 
     /* Set up the system side of the screen */
     gotoxy(DBG_SCRN_DIV_X + 14, 2);
-    printf(" S Y S T E M ");
+    vUtilityDraw(" S Y S T E M ");
 
     /* Draw the display */
     vUtilityDrawBox(DBG_SCRN_DISP_X, DBG_SCRN_DISP_Y,
@@ -361,7 +691,7 @@ void vHardwareInit(void) {
         DBG_SCRN_PRNTR_WIDTH, 1);
     gotoxy(DBG_SCRN_PRNTR_X + 1,
         DBG_SCRN_PRNTR_Y + DBG_SCRN_PRNTR_HEIGHT + 2);
-    printf(" ^^ PRINTER ^^ ");
+    vUtilityDraw(" ^^ PRINTER ^^ ");
 
     /* Initialize printer lines */
     for (iRow = 0; iRow < DBG_SCRN_PRNTR_HEIGHT; ++iRow)
@@ -372,21 +702,28 @@ void vHardwareInit(void) {
         DBG_SCRN_BELL_WIDTH,
         DBG_SCRN_BELL_HEIGHT);
     gotoxy(DBG_SCRN_BELL_X + 1, DBG_SCRN_BELL_Y + 2);
-    printf(" BELL ");
-
+    vUtilityDraw(" BELL ");
 
+    /* The renderer shows it all at once, when it starts */
 }
 
 /* Called from prvKeyboardInterruptSimulatorTask(), which is defined in main.c. */
 void vSimulationKeyboardInterruptHandler(int xKeyPressed)
 {
+    DBG_DRAW dd;  /* What to show. */
+
+    /* While the simulation drives the hardware, the keyboard may
+       only end the program; anything else would make the run differ
+       from the last one with the same seed. */
+    if (fSimRunning() && toupper(xKeyPressed) != 'X')
+        return;
 
     /* If the system set up the floats, cause the float interrupt. */
     if (iTankToRead != NO_TANK)
         vFloatInterrupt();
 
-    /* Handle keyboard input. */
-    xSemaphoreTake(xWinSem, portMAX_DELAY);
+    /* Handle keyboard input.  This is an interrupt, so it only tells
+       the renderer what to show, without waiting. */
     switch (xKeyPressed)
     {
     case '/':
@@ -397,20 +734,9 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
     case 'o':
         fAutoTime = !fAutoTime;
 
-        if (fAutoTime)
-        {
-            gotoxy(15, DBG_SCRN_TIME_ROW + 3);
-            setTextBackgroundColor(GREEN);
-            printf(" ON  ");
-            setTextBackgroundColor(BLACK);
-        }
-        else
-        {
-            gotoxy(15, DBG_SCRN_TIME_ROW + 3);
-            setTextBackgroundColor(RED);
-            printf(" OFF ");
-            setTextBackgroundColor(BLACK);
-        }
+        dd.byOp = DBG_DRAW_AUTOTIME;
+        dd.byArg = (BYTE)fAutoTime;
+        vDebugDraw(&dd, FALSE);
         break;
     case 't':
     case 'T':
@@ -425,6 +751,10 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
     case 'a':
     case 'H':
     case 'h':
+    case 'G':
+    case 'g':
+    case 'B':
+    case 'b':
         /* Note which button has been pressed. */
 
         wButton = toupper(xKeyPressed);
@@ -447,15 +777,19 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
                 ++iLastBtnRow;
         }
         
-        /* Blink the button red. */
-        setTextBackgroundColor(DBG_SCRN_BTN_BLINK_COLOR);
-        gotoxy(DBG_SCRN_BTN_X + iLastBtnCol * DBG_SCRN_BTN_WIDTH,
-            DBG_SCRN_BTN_Y + iLastBtnRow * DBG_SCRN_BTN_HEIGHT);
-        printf("%s", p_chButtonText[iLastBtnRow][iLastBtnCol]);
-        setTextBackgroundColor(BLACK);
+        dd.sRow = (short)iLastBtnRow;
+        dd.sColumn = (short)iLastBtnCol;
+
+        /* Turn it back in a moment. */
+        xTimerChangePeriodFromISR(xBlinkTimer, DBG_BTN_BLINK_TIME, NULL);
 
         taskEXIT_CRITICAL();
 
+        /* Blink the button red. */
+        dd.byOp = DBG_DRAW_BUTTON;
+        dd.byArg = DBG_SCRN_BTN_BLINK_COLOR;
+        vDebugDraw(&dd, FALSE);
+
         /* Fake a button interrupt. */
         vButtonInterrupt();
         break;
@@ -465,7 +799,8 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
         a_iTankLevels[iTankChanging] -= 80;
         if (a_iTankLevels[iTankChanging] < 0)
             a_iTankLevels[iTankChanging] = 0;
-        vUtilityDisplayFloatLevels();
+        dd.byOp = DBG_DRAW_FLOATS;
+        vDebugDraw(&dd, FALSE);
         break;
 
     case '+':
@@ -473,13 +808,41 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
         a_iTankLevels[iTankChanging] += 80;
         if (a_iTankLevels[iTankChanging] > 8000)
             a_iTankLevels[iTankChanging] = 8000;
-        vUtilityDisplayFloatLevels();
+        dd.byOp = DBG_DRAW_FLOATS;
+        vDebugDraw(&dd, FALSE);
+        break;
+
+    case 's':
+    case 'S':
+        /* Run the simulated hardware at the next speed. */
+        iScaleChosen = (iScaleChosen + 1) % DBG_SCALES;
+        vTimerScaleSet(a_iScales[iScaleChosen]);
+        dd.byOp = DBG_DRAW_SPEED;
+        vDebugDraw(&dd, FALSE);
+        break;
+
+    case 'k':
+    case 'K':
+        /* Start timing button presses, unless already doing so. */
+        if (xInjectTask != NULL && !fInjecting)
+        {
+            fInjecting = TRUE;
+            vTaskNotifyGiveFromISR(xInjectTask, NULL);
+        }
+        break;
+
+    case 'c':
+    case 'C':
+        /* Cancel the latest print job. */
+        fPrintJobCancel(iPrintLastJobNumber());
         break;
 
     case 'x':
     case 'X':
-        /* End the program. */
-        exit(0);
+        /* End the program, once the renderer has drawn what is
+           waiting and reported the statistics. */
+        fDebugExit = TRUE;
+        vTaskNotifyGiveFromISR(xRenderTask, NULL);
         break;
 
     case '>':
@@ -487,7 +850,8 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
         ++iTankChanging;
         if (iTankChanging == COUNTOF_TANKS)
             iTankChanging = COUNTOF_TANKS - 1;
-        vUtilityDisplayFloatLevels();
+        dd.byOp = DBG_DRAW_FLOATS;
+        vDebugDraw(&dd, FALSE);
         break;
 
     case '<':
@@ -495,59 +859,335 @@ void vSimulationKeyboardInterruptHandler(int xKeyPressed)
         --iTankChanging;
         if (iTankChanging < 0)
             iTankChanging = 0;
-        vUtilityDisplayFloatLevels();
+        dd.byOp = DBG_DRAW_FLOATS;
+        vDebugDraw(&dd, FALSE);
         break;
 
     }
-    xSemaphoreGive(xWinSem);
 }
 
+/* Makes the 1/3-second tick.  Waking at fixed times, rather than
+   a fixed delay after the last pass, keeps the time of this loop's
+   own work from adding up.  When the simulation runs fast, it wakes
+   more often, or makes several ticks each time it wakes.  Flat out,
+   it makes a batch of ticks and then sleeps for a system tick, so
+   that the tasks below it still get to run. */
 static void vDebugTimerTask(void* pvParameters) {
 
+    TickType_t xLastWake;
+    TickType_t xOrigin;
+    TickType_t xNext;
+    unsigned long ulDone;
+    unsigned long ulDue;
+    unsigned long ulPerSecond;
+    int iScale;
+    int iScaleLast;
+    unsigned long long ullNow;
+    unsigned long long ullOrigin;
+    unsigned long long ullExact;
+    long long llDriftBefore;
+
     /* Prevent the compiler warning about the unused parameter. */
     (void)pvParameters;
 
-    /* Test Variables */
-    int a_iTime[4];
+    xLastWake = xTaskGetTickCount();
+    xOrigin = xLastWake;
+    ullOrigin = ullStatsMicroseconds();
+    ulDone = 0;
+    iScaleLast = 0;
+    llDriftBefore = 0;
 
     for (;;) {
-        vTaskDelay(185);
+        iScale = iTimerScale();
+        if (iScale == TIMER_SCALE_MAX)
+        {
+            /* Flat out: tick until the batch is done or the system
+               tick moves on, then give up the processor. */
+            iScaleLast = iScale;
+            if (fAutoTime && !fSimRunning())
+            {
+                xLastWake = xTaskGetTickCount();
+                ulDone = 0;
+                do
+                {
+                    vTimerOneThirdSecond();
+                    ++ulDone;
+                } while (ulDone < DBG_FLAT_OUT_TICKS &&
+                    xTaskGetTickCount() == xLastWake);
+            }
+            vTaskDelay(1);
+            continue;
+        }
 
-        /* Unblink a button, if necessary. */ // Move to debugTimerTask
-        taskENTER_CRITICAL();
+        /* Tick k is due exactly k thirds of a second (at this speed)
+           after the speed was chosen, so no rounding builds up. */
+        if (iScale != iScaleLast)
+        {
+            xLastWake = xTaskGetTickCount();
+            xOrigin = xLastWake;
+            ullOrigin = ullStatsMicroseconds();
+            ulDone = 0;
+            llDriftBefore = llTickDrift;
+            iScaleLast = iScale;
+        }
+        ulPerSecond = TIMER_TICKS_PER_SECOND * iScale;
+
+        /* Sleep until the system tick on or after the next one is
+           due: 334, 333 and 333 ms apart at real speed. */
+        xNext = xOrigin + (TickType_t)(((unsigned long long)(ulDone + 1) *
+            configTICK_RATE_HZ + ulPerSecond - 1) / ulPerSecond);
+        vTaskDelayUntil(&xLastWake, xNext - xLastWake);
+
+        /* Do every tick that is due by now. */
+        ullNow = ullStatsMicroseconds();
+        ulDue = (unsigned long)((unsigned long long)(TickType_t)(xTaskGetTickCount() - xOrigin) *
+            ulPerSecond / configTICK_RATE_HZ);
+        for (; ulDone < ulDue; ++ulDone)
+        {
+            /* Note how far it is from a true third of a second, if
+               running at real speed. */
+            if (iScale == 1)
+            {
+                ullExact = ullOrigin + (unsigned long long)(ulDone + 1) * 1000000ULL /
+                    TIMER_TICKS_PER_SECOND;
+                vStatsHistAdd(&shTickJitter, (unsigned long)(ullNow > ullExact ?
+                    ullNow - ullExact : ullExact - ullNow));
+                llTickDrift = llDriftBefore + (long long)ullNow - (long long)ullExact;
+                ++ulTicksMeasured;
+            }
+
+            if (fAutoTime && !fSimRunning())
+                vTimerOneThirdSecond();
+        }
 
-        if (fBtnFound)
+        /* Every second is a whole number of system ticks, so move the
+           origin on a second at a time to keep the numbers small. */
+        while (ulDone >= ulPerSecond)
         {
-            xSemaphoreTake(xWinSem, portMAX_DELAY);
-            setTextBackgroundColor(DBG_SCRN_BTN_COLOR);
-            gotoxy(DBG_SCRN_BTN_X + iLastBtnCol * DBG_SCRN_BTN_WIDTH,
-                DBG_SCRN_BTN_Y + iLastBtnRow * DBG_SCRN_BTN_HEIGHT);
-            printf("%s", p_chButtonText[iLastBtnRow][iLastBtnCol]);
-            setTextBackgroundColor(BLACK);
-            xSemaphoreGive(xWinSem);
-            fBtnFound = FALSE;
+            ulDone -= ulPerSecond;
+            xOrigin += configTICK_RATE_HZ;
+            ullOrigin += 1000000ULL;
         }
+    }
 
-        taskEXIT_CRITICAL();
+}
+
+/* Puts the last pressed button back to its usual color. */
+static void vDebugUnblink(TimerHandle_t xTimer) {
+
+    DBG_DRAW dd;
+    BOOL fUnblink;
+
+    (void)xTimer;
+
+    taskENTER_CRITICAL();
+    fUnblink = fBtnFound;
+    dd.sRow = (short)iLastBtnRow;
+    dd.sColumn = (short)iLastBtnCol;
+    fBtnFound = FALSE;
+    taskEXIT_CRITICAL();
+
+    /* This runs in the timer task, which also runs the printer, so
+       do not wait for room to draw. */
+    if (fUnblink)
+    {
+        dd.byOp = DBG_DRAW_BUTTON;
+        dd.byArg = DBG_SCRN_BTN_COLOR;
+        vDebugDraw(&dd, FALSE);
+    }
+}
+
+
+/* Presses the buttons from a script, on a fixed clock for each run,
+   and times how long each press takes to reach the display and the
+   printer, from when it was due.  Runs when the user presses 'K'. */
+static void vDebugInjectTask(void* pvParameters) {
+
+    const INJECT_STEP* p_is;
+    INJECT_PRESS* p_ip;
+    TickType_t xGap;
+    TickType_t xWake;
+    unsigned long long ullStart;
+    unsigned long long ullAt;
+    int iPress;
+    int iSteps;
+    BOOL fWaiting;
+
+    /* Prevent the compiler warning about the unused parameter. */
+    (void)pvParameters;
+
+    iSteps = (int)(sizeof(a_isScript) / sizeof(a_isScript[0]));
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-        /* Check if system is currently printing */
-        if (iPrinting)
+        for (iInjectRun = 0; iInjectRun < INJECT_RUNS; ++iInjectRun)
         {
-            /* Yes. */
-            --iPrinting;
-            if (iPrinting == 0)
+            vStatsHistInit(&a_shInjectDisplay[iInjectRun]);
+            vStatsHistInit(&a_shInjectPrint[iInjectRun]);
+            a_ulInjectMissed[iInjectRun] = 0;
+            a_ulInjectOvertaken[iInjectRun] = 0;
+            fInjectLoad = iInjectRun >= INJECT_RATES;
+            xGap = a_xInjectGap[iInjectRun % INJECT_RATES];
+
+            xWake = xTaskGetTickCount();
+            ullStart = ullStatsMicroseconds();
+            for (iPress = 0; iPress < INJECT_PASSES * iSteps; ++iPress)
             {
-                /* We have finished. Call the interrupt routine. */
-                vPrinterInterrupt();
+                p_is = &a_isScript[iPress % iSteps];
+                ullAt = ullStart +
+                    (unsigned long long)iPress * xGap * portTICK_PERIOD_MS * 1000ULL;
+
+                /* Press the button, the way the keyboard would, and
+                   remember what it should cause. */
+                taskENTER_CRITICAL();
+                vDebugInjectExpire(ullAt, FALSE);
+                if (iInjectWaiting == INJECT_PENDING)
+                    vDebugInjectExpire(ullAt, TRUE);
+                p_ip = &a_ipInject[(iInjectOldest + iInjectWaiting) % INJECT_PENDING];
+                p_ip->ullAt = ullAt;
+                p_ip->p_is = p_is;
+                p_ip->byWaiting = INJECT_OUT_DISPLAY |
+                    (p_is->p_chPrint != NULL ? INJECT_OUT_PRINT : 0);
+                ++iInjectWaiting;
+                wButton = p_is->chKey;
+                vButtonInterrupt();
+                taskEXIT_CRITICAL();
+
+                /* The next press is due on the clock, not when this
+                   one is done. */
+                vTaskDelayUntil(&xWake, xGap);
             }
+
+            /* Give the last presses their time to cause output. */
+            do
+            {
+                taskENTER_CRITICAL();
+                vDebugInjectExpire(ullStatsMicroseconds(), FALSE);
+                fWaiting = iInjectWaiting > 0;
+                taskEXIT_CRITICAL();
+                if (fWaiting)
+                    vTaskDelay(INJECT_DRAIN_POLL);
+            } while (fWaiting);
+
+            iInjectRunsDone = iInjectRun + 1;
         }
 
-        if (fAutoTime)
-            vTimerOneThirdSecond();
+        fInjectLoad = FALSE;
+        fInjecting = FALSE;
+    }
+}
+
+/* Keeps the CPU busy above the button and display tasks while a
+   loaded run is going on. */
+static void vDebugLoadTask(void* pvParameters) {
+
+    TickType_t xStart;
+
+    /* Prevent the compiler warning about the unused parameter. */
+    (void)pvParameters;
+
+    for (;;) {
+        if (!fInjectLoad)
+        {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        xStart = xTaskGetTickCount();
+        while (xTaskGetTickCount() - xStart < INJECT_LOAD_BUSY)
+            ;
+        vTaskDelay(INJECT_LOAD_IDLE);
+    }
+}
+
+/* Notes an output from the system: the whole display line, or one
+   printed line.  The oldest press still waiting for that output that
+   it matches is done, and so is every press before it that was still
+   waiting for the same output, since their output has been
+   overtaken. */
+static void vDebugInjectSeen(BYTE byOutput, const char* p_chText) {
+
+    unsigned long long ullNow;
+    INJECT_PRESS* p_ip;
+    const char* p_chPattern;
+    int iMatch;
+    int i;
+
+    ullNow = ullStatsMicroseconds();
+
+    taskENTER_CRITICAL();
+    for (iMatch = 0; iMatch < iInjectWaiting; ++iMatch)
+    {
+        p_ip = &a_ipInject[(iInjectOldest + iMatch) % INJECT_PENDING];
+        p_chPattern = byOutput == INJECT_OUT_DISPLAY ?
+            p_ip->p_is->p_chDisplay : p_ip->p_is->p_chPrint;
+        if ((p_ip->byWaiting & byOutput) &&
+            fDebugInjectMatch(p_chPattern, p_chText, byOutput == INJECT_OUT_PRINT))
+            break;
     }
 
+    if (iMatch < iInjectWaiting)
+    {
+        for (i = 0; i <= iMatch; ++i)
+        {
+            p_ip = &a_ipInject[(iInjectOldest + i) % INJECT_PENDING];
+            if ((p_ip->byWaiting & byOutput) == 0)
+                continue;
+            p_ip->byWaiting &= ~byOutput;
+            vStatsHistAdd(byOutput == INJECT_OUT_DISPLAY ?
+                &a_shInjectDisplay[iInjectRun] : &a_shInjectPrint[iInjectRun],
+                (unsigned long)(ullNow - p_ip->ullAt));
+            if (i < iMatch)
+                ++a_ulInjectOvertaken[iInjectRun];
+        }
+
+        /* Forget the oldest presses once they have all their output. */
+        while (iInjectWaiting > 0 && a_ipInject[iInjectOldest].byWaiting == 0)
+        {
+            iInjectOldest = (iInjectOldest + 1) % INJECT_PENDING;
+            --iInjectWaiting;
+        }
+    }
+    taskEXIT_CRITICAL();
 }
 
+/* Says whether some text matches a pattern from the script, where
+   '#' stands for any digit.  The text must start with the pattern,
+   and if fWhole, have nothing after it. */
+static BOOL fDebugInjectMatch(const char* p_chPattern, const char* p_chText, BOOL fWhole) {
+
+    for (; *p_chPattern != '\0'; ++p_chPattern, ++p_chText)
+    {
+        if (*p_chPattern == '#' ? !isdigit((unsigned char)*p_chText) :
+            *p_chPattern != *p_chText)
+            return(FALSE);
+    }
+
+    return(!fWhole || *p_chText == '\0');
+}
+
+/* Gives up on the presses, oldest first, that have waited too long
+   for their output by ullNow, or on the oldest one if fAll, counting
+   each one that is still waiting as missed.  Interrupts must be off. */
+static void vDebugInjectExpire(unsigned long long ullNow, BOOL fAll) {
+
+    INJECT_PRESS* p_ip;
+
+    while (iInjectWaiting > 0)
+    {
+        p_ip = &a_ipInject[iInjectOldest];
+        if (p_ip->byWaiting != 0)
+        {
+            if (!fAll && ullNow - p_ip->ullAt < INJECT_TIMEOUT_US)
+                break;
+            ++a_ulInjectMissed[iInjectRun];
+            fAll = FALSE;
+        }
+        iInjectOldest = (iInjectOldest + 1) % INJECT_PENDING;
+        --iInjectWaiting;
+    }
+}
 
 //static void vDebugAdditionalTasks(void* pvParameters) {
 //    /* Prevent the compiler warning about the unused parameter. */
@@ -616,27 +1256,27 @@ static void vUtilityDrawBox(/*INPUTS:*/
 
     // Draw the top of the box
     gotoxy(iXNW, iYNW);
-    printf("%c", LINE_CORNER_NW);
+    vUtilityDraw("%c", LINE_CORNER_NW);
     for (iColumn = 0; iColumn < iScaledXSize; iColumn++) {
-        printf("%c", LINE_HORIZ);
+        vUtilityDraw("%c", LINE_HORIZ);
     }
-    printf("%c", LINE_CORNER_NE);
+    vUtilityDraw("%c", LINE_CORNER_NE);
 
     // Draw the sides
     for (iRow = 1; iRow <= iYSize; iRow++) {
         gotoxy(iXNW, iYNW + iRow);
-        printf("%c", LINE_VERT);
+        vUtilityDraw("%c", LINE_VERT);
         gotoxy(iXNW + iScaledXSize + 1, iYNW + iRow);
-        printf("%c", LINE_VERT);
+        vUtilityDraw("%c", LINE_VERT);
     }
 
     // Draw the bottom
     gotoxy(iXNW, iYNW + iYSize + 1);
-    printf("%c", LINE_CORNER_SW);
+    vUtilityDraw("%c", LINE_CORNER_SW);
     for (iColumn = 0; iColumn < iScaledXSize; iColumn++) {
-        printf("%c", LINE_HORIZ);
+        vUtilityDraw("%c", LINE_HORIZ);
     }
-    printf("%c", LINE_CORNER_SE);
+    vUtilityDraw("%c", LINE_CORNER_SE);
 }
 
 static void vUtilityDisplayFloatLevels(void) {
@@ -650,15 +1290,200 @@ static void vUtilityDisplayFloatLevels(void) {
         if (iTank == iTankChanging)
             setTextBackgroundColor(BLUE);
         gotoxy(iTank * 8 + 10, DBG_SCRN_FLOAT_ROW);
-        printf(" %4d ", iTank + 1);
+        vUtilityDraw(" %4d ", iTank + 1);
         gotoxy(iTank * 8 + 10, DBG_SCRN_FLOAT_ROW + 1);
-        printf(" ---- ");
+        vUtilityDraw(" ---- ");
         gotoxy(iTank * 8 + 10, DBG_SCRN_FLOAT_ROW + 2);
-        printf(" %4d ", a_iTankLevels[iTank]);
+        vUtilityDraw(" %4d ", a_iTankLevels[iTank]);
         setTextBackgroundColor(BLACK);
     }
 }
 
+/***** vDebugReportStats ********************************************
+
+This routine prints the statistics gathered by the system below
+the simulated screen.
+
+RETURNS: None.
+*/
+
+static void vDebugReportStats(void)
+{
+    /* LOCAL VARIABLES: */
+    FLOAT_STATS fs;    /* Float cache counters. */
+    OFLOW_STATS os;    /* Overflow task counters. */
+    FLOAT_LATENCY fl;  /* Float latency for one tank. */
+    DISPLAY_STATS ds;  /* Display write counters. */
+    KEY_STATS ks;      /* Keyboard ring counters. */
+    PRINT_STATS ps;    /* Print spooler counters. */
+    PRINT_JOB_STATUS pjs;  /* One print job. */
+    STATS_HIST shCritical;  /* Time with interrupts off. */
+    int iJob;          /* Iterator. */
+    int iTank;         /* Iterator. */
+    int iRun;          /* Iterator. */
+    unsigned long long ullSeconds;  /* How long the screen has run. */
+
+    /*-------------------------------------------------------*/
+
+    vUtilityEndScreen();
+
+    vFloatGetStats(&fs);
+    printf("Float cache: %lu requests, %lu hits (%lu%%), "
+        "%lu float reads saved\n",
+        fs.ulRequests, fs.ulCacheHits,
+        fs.ulRequests ? fs.ulCacheHits * 100 / fs.ulRequests : 0,
+        fs.ulCacheHits);
+
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        vFloatGetLatency(iTank, &fl);
+        printf("Tank %d floats: %lu reads, p50 %lu p99 %lu max %lu "
+            "thirds of a second, %lu timeouts, %lu stuck\n",
+            iTank + 1, fl.ulReads, fl.ulP50, fl.ulP99, fl.ulMax,
+            fl.ulTimeouts, fl.ulStuck);
+    }
+
+    vOverflowGetStats(&os);
+    printf("Overflow: %lu ticks, %lu handled late, %lu messages with no room\n",
+        os.ulTicks, os.ulTicksLate, os.ulPostsFailed);
+
+    vDisplayGetStats(&ds);
+    printf("Display: %lu changes coalesced into %lu wakeups, %lu renders, "
+        "%lu writes suppressed, %lu writes issued, %lu characters sent\n",
+        ds.ulNotifications, ds.ulWakeups, ds.ulRenders, ds.ulWritesSuppressed,
+        ds.ulWritesIssued, ds.ulCellsWritten);
+
+    vKeyboardGetStats(&ks);
+    printf("Keyboard: %lu keys in %lu interrupts, %lu coalesced, "
+        "%lu waits for a full ring, %lu dropped\n",
+        ks.ulKeys, ks.ulInterrupts, ks.ulCoalesced,
+        ks.ulFullWaits, ks.ulDropped);
+
+    vPrintGetStats(&ps);
+    printf("Printer: %lu jobs submitted, %lu duplicates merged, %lu rejected, "
+        "%lu printed, %lu cancelled; %lu lines formatted, %lu from cache\n",
+        ps.ulSubmitted, ps.ulDuplicates, ps.ulRejected,
+        ps.ulPrinted, ps.ulCancelled, ps.ulLinesFormatted, ps.ulLinesCached);
+    for (iJob = iPrintLastJobNumber() - 4; iJob <= iPrintLastJobNumber(); ++iJob)
+    {
+        if (iJob > 0 && fPrintJobStatus(iJob, &pjs))
+            printf("  Job %d: %s, waited %lu ms, printed for %lu ms\n",
+                iJob,
+                pjs.byState == PRINT_JOB_QUEUED ? "waiting" :
+                pjs.byState == PRINT_JOB_PRINTING ? "printing" :
+                pjs.byState == PRINT_JOB_DONE ? "done" : "cancelled",
+                pjs.ulQueued * 1000 / TIMER_TICKS_PER_SECOND,
+                pjs.ulPrinting * 1000 / TIMER_TICKS_PER_SECOND);
+    }
+
+    printf("Tick: %lu ticks, off their exact thirds of a second by p50 %lu "
+        "p99 %lu max %lu us, %lld us drift\n",
+        ulTicksMeasured,
+        ulStatsHistPercentile(&shTickJitter, 50),
+        ulStatsHistPercentile(&shTickJitter, 99),
+        shTickJitter.ulMax,
+        llTickDrift);
+    printf("Printer timer: %lu batches, late p50 %lu p99 %lu max %lu us\n",
+        shPrinterLate.ulCount,
+        ulStatsHistPercentile(&shPrinterLate, 50),
+        ulStatsHistPercentile(&shPrinterLate, 99),
+        shPrinterLate.ulMax);
+
+    for (iRun = 0; iRun < iInjectRunsDone; ++iRun)
+    {
+        printf("Buttons every %lu ms%s: display p50 %lu p99 %lu max %lu us, "
+            "print p50 %lu p99 %lu max %lu us, %lu missed, %lu overtaken\n",
+            (unsigned long)(a_xInjectGap[iRun % INJECT_RATES] * portTICK_PERIOD_MS),
+            iRun >= INJECT_RATES ? " under load" : "",
+            ulStatsHistPercentile(&a_shInjectDisplay[iRun], 50),
+            ulStatsHistPercentile(&a_shInjectDisplay[iRun], 99),
+            a_shInjectDisplay[iRun].ulMax,
+            ulStatsHistPercentile(&a_shInjectPrint[iRun], 50),
+            ulStatsHistPercentile(&a_shInjectPrint[iRun], 99),
+            a_shInjectPrint[iRun].ulMax,
+            a_ulInjectMissed[iRun], a_ulInjectOvertaken[iRun]);
+    }
+
+    ullSeconds = (ullStatsMicroseconds() - ullScreenSince) / 1000000ULL;
+    if (ullSeconds == 0)
+        ullSeconds = 1;
+    printf("Screen: %lu drawing calls (%lu a second) sent as %lu frames "
+        "(%lu writes a second), %lu cells; frame p50 %lu p99 %lu max %lu us\n",
+        ulScreenCalls, (unsigned long)(ulScreenCalls / ullSeconds),
+        ulScreenFrames, (unsigned long)(ulScreenFrames / ullSeconds),
+        ulScreenCells,
+        ulStatsHistPercentile(&shScreenFrame, 50),
+        ulStatsHistPercentile(&shScreenFrame, 99),
+        shScreenFrame.ulMax);
+    printf("Renderer: %lu commands, %lu waits for room, %lu dropped\n",
+        (unsigned long)lDrawPosted, (unsigned long)lDrawWaits,
+        (unsigned long)lDrawDropped);
+
+    vStatsGetCritical(&shCritical);
+    printf("Critical sections: interrupts off %lu times, p50 %lu p99 %lu "
+        "worst %lu us\n",
+        shCritical.ulCount,
+        ulStatsHistPercentile(&shCritical, 50),
+        ulStatsHistPercentile(&shCritical, 99),
+        shCritical.ulMax);
+}
+
+/* Runs the module self-tests and benchmarks, and exits with 1 if any
+   of them failed. */
+static void vDebugSelfTest(void)
+{
+    /* LOCAL VARIABLES: */
+    SELF_TEST st;               /* One test's results. */
+    unsigned long ulFailures;   /* Failures in every test. */
+
+    /*-------------------------------------------------------*/
+
+    ulFailures = 0;
+
+    vOverflowBenchmark(DBG_TEST_OFLOW_TANKS, DBG_TEST_OFLOW_TANKS, &st);
+    ulFailures += ulDebugSelfTestReport("Overflow wheel, 100000 tanks all watched",
+        "scanning every tank", &st);
+    vOverflowBenchmark(DBG_TEST_OFLOW_TANKS, DBG_TEST_OFLOW_FEW, &st);
+    ulFailures += ulDebugSelfTestReport("Overflow wheel, 1000 of 100000 tanks watched",
+        "scanning every tank", &st);
+    vAlarmBenchmark(DBG_TEST_ALARM_TANKS, &st);
+    ulFailures += ulDebugSelfTestReport("Alarm scan, 10000 tanks",
+        "checking a tank at a time", &st);
+    vFormatSelfTest(&st);
+    ulFailures += ulDebugSelfTestReport("Line templates", "with sprintf", &st);
+    vButtonSelfTest(&st);
+    ulFailures += ulDebugSelfTestReport("Button commands, every state and key",
+        NULL, &st);
+
+    printf("Self-test %s\n", ulFailures == 0 ? "passed" : "FAILED");
+    exit(ulFailures == 0 ? 0 : 1);
+}
+
+/* Prints one test's results, and returns how many checks failed. */
+static unsigned long ulDebugSelfTestReport(
+    const char* p_chWhat,       /* What was tested. */
+    const char* p_chBaseline,   /* The old way, or NULL if not timed. */
+    const SELF_TEST* p_st)      /* The results. */
+{
+    printf("%s: %lu checked, %lu failed", p_chWhat, p_st->ulCases,
+        p_st->ulFailures);
+    if (p_chBaseline != NULL)
+        printf("; %llu us, against %llu us %s", p_st->ullMicroseconds,
+            p_st->ullBaseline, p_chBaseline);
+    printf("\n");
+
+    return(p_st->ulFailures);
+}
+
+static void vUtilityDisplaySpeed(void)
+{
+    gotoxy(1, DBG_SCRN_TIME_ROW + 2);
+    if (a_iScales[iScaleChosen] == TIMER_SCALE_MAX)
+        vUtilityDraw(" 'S' to change speed: max  ");
+    else
+        vUtilityDraw(" 'S' to change speed: x%-5d", a_iScales[iScaleChosen]);
+}
+
 static void vUtilityPrinterDisplay(void)
 {
 
@@ -668,22 +1493,60 @@ static void vUtilityPrinterDisplay(void)
     {
         gotoxy(DBG_SCRN_PRNTR_X + 1, DBG_SCRN_PRNTR_Y + i + 1);
         for (j = 0; j < DBG_SCRN_PRNTR_WIDTH; ++j)
-            printf(" ");
+            vUtilityDraw(" ");
         gotoxy(DBG_SCRN_PRNTR_X + 1, DBG_SCRN_PRNTR_Y + i + 1);
-        printf(aa_charPrinted[i]);
+        vUtilityDraw("%s", aa_charPrinted[i]);
     }
 }
 
 void vHardwareDisplayLine(char* a_chDisp) {
 
+    DBG_DRAW dd;
+
     assert(strlen(a_chDisp) <= DBG_SCRN_DISP_WIDTH);
 
-    xSemaphoreTake(xWinSem, portMAX_DELAY);
-    gotoxy(DBG_SCRN_DISP_X + 1, DBG_SCRN_DISP_Y + 1);
-    printf(" ");
-    gotoxy(DBG_SCRN_DISP_X + 1, DBG_SCRN_DISP_Y + 1);
-    printf("%s", a_chDisp);
-    xSemaphoreGive(xWinSem, portMAX_DELAY);
+    dd.byOp = DBG_DRAW_DISPLAY;
+    dd.byArg = TRUE;
+    dd.sColumn = 0;
+    strcpy(dd.a_chText, a_chDisp);
+    vDebugDraw(&dd, TRUE);
+
+    if (fSimRunning())
+        vSimTrace("DISPLAY", 0, a_chDisp, (int)strlen(a_chDisp));
+
+    /* Only the display task writes the display, so this copy needs
+       no lock. */
+    memset(a_chInjectShown, ' ', DBG_SCRN_DISP_WIDTH);
+    memcpy(a_chInjectShown, a_chDisp, strlen(a_chDisp));
+    a_chInjectShown[DBG_SCRN_DISP_WIDTH] = '\0';
+    vDebugInjectSeen(INJECT_OUT_DISPLAY, a_chInjectShown);
+}
+
+void vHardwareDisplayChars(int iColumn, char* a_chChars, int iCount) {
+
+    DBG_DRAW dd;
+
+    assert(iColumn >= 0 && iCount >= 0 && iColumn + iCount <= DBG_SCRN_DISP_WIDTH);
+
+    dd.byOp = DBG_DRAW_DISPLAY;
+    dd.byArg = FALSE;
+    dd.sColumn = (short)iColumn;
+    memcpy(dd.a_chText, a_chChars, iCount);
+    dd.a_chText[iCount] = '\0';
+    vDebugDraw(&dd, TRUE);
+
+    if (fSimRunning())
+        vSimTrace("DISPLAY", iColumn, a_chChars, iCount);
+
+    memcpy(a_chInjectShown + iColumn, a_chChars, iCount);
+    vDebugInjectSeen(INJECT_OUT_DISPLAY, a_chInjectShown);
+}
+
+/* Presses a button, without the keyboard; the simulation uses this. */
+void vSimulationButtonPress(WORD wKey) {
+
+    wButton = wKey;
+    vButtonInterrupt();
 }
 
 WORD wHardwareButtonFetch(void) {
@@ -700,6 +1563,28 @@ void vHardwareFloatSetup(int iTankNumber) {
 
     /* Remember which tank the system asked about. */
     iTankToRead = iTankNumber;
+
+    /* While time passes by itself, so do the floats, at the speed
+       of the rest of the simulated hardware.  Any faster than real
+       speed, a real timer would fall behind the simulated clock and
+       the read would miss its deadline, so they answer with the next
+       tick instead. */
+    if (fSimRunning())
+        vSimFloatsStarted(iTankNumber);
+    else if (fAutoTime && iTimerScale() == 1)
+        xTimerChangePeriod(xFloatsTimer, DBG_FLOAT_LATENCY, 0);
+    else if (fAutoTime)
+        fFloatsDue = TRUE;
+}
+
+void vHardwareFloatCancel(void) {
+
+    /* The floats stop looking, whether or not they were. */
+    iTankToRead = NO_TANK;
+    fFloatsDue = FALSE;
+
+    if (fSimRunning())
+        vSimFloatsCancelled();
 }
 
 int iHardwareFloatGetData(void) {
@@ -714,83 +1599,580 @@ int iHardwareFloatGetData(void) {
 
     /* We're not reading anymore. */
     iTankToRead = NO_TANK;
+    fFloatsDue = FALSE;
 
     /* Return the tank reading. */
+    if (fSimRunning())
+        return(iSimTankLevel(iTankTemp));
     return(a_iTankLevels[iTankTemp]);
 }
 
 void vHardwareBellOn(void) {
 
-    xSemaphoreTake(xWinSem, portMAX_DELAY);
+    DBG_DRAW dd;
 
-    /* Set the bell color. */
-    setTextBackgroundColor(RED);
-    gotoxy(DBG_SCRN_BELL_X + 1, DBG_SCRN_BELL_Y + 2);
-    printf(" BELL ");
-    setTextBackgroundColor(BLACK);
+    dd.byOp = DBG_DRAW_BELL;
+    dd.byArg = TRUE;
+    vDebugDraw(&dd, TRUE);
 
-    xSemaphoreGive(xWinSem);
+    if (fSimRunning())
+        vSimTrace("BELL", 0, "ON", 2);
 }
 
 void vHardwareBellOff(void) {
 
-    xSemaphoreTake(xWinSem, portMAX_DELAY);
+    DBG_DRAW dd;
 
-    /* Re-draw bell in plain text. */
-    gotoxy(DBG_SCRN_BELL_X + 1, DBG_SCRN_BELL_Y + 2);
-    printf(" BELL ");
+    dd.byOp = DBG_DRAW_BELL;
+    dd.byArg = FALSE;
+    vDebugDraw(&dd, TRUE);
 
-    xSemaphoreGive(xWinSem);
+    if (fSimRunning())
+        vSimTrace("BELL", 0, "OFF", 3);
 }
 
-void vHardwarePrinterOutputLine(char* a_chPrint)  /* Character string to print */
+void vHardwarePrinterOutputBatch(
+    const PRINTER_LINE* a_pl,  /* The lines to print */
+    int iCount)                /* How many there are */
 {
 
     /* LOCAL VARIABLES:*/
-    int i;  /* The usual. */
+    int j;  /* The usual. */
+    TickType_t xTicks;  /* Time to print the batch. */
+    DBG_DRAW dd;  /* A line for the renderer. */
 
     /*-------------------------------------------------------*/
 
-    /* Check that the length of the string is OK */
-    assert(strlen(a_chPrint) <= DBG_SCRN_PRNTR_WIDTH);
+    /* The batch must fit in the printer's buffer */
+    assert(iCount > 0 && iCount <= iPrinterBufferLines);
 
-    /* Move all the old lines up. */
-    for (i = 1; i < DBG_SCRN_PRNTR_HEIGHT; ++i)
-        strcpy(aa_charPrinted[i - 1], aa_charPrinted[i]);
+    for (j = 0; j < iCount; ++j)
+    {
+        /* Check that the length of the string is OK */
+        assert(strlen(a_pl[j].p_chLine) <= DBG_SCRN_PRNTR_WIDTH);
+
+        /* The printer task calls this with interrupts on, so it
+           waits for room to draw rather than lose a line. */
+        dd.byOp = DBG_DRAW_PRINTER;
+        strcpy(dd.a_chText, a_pl[j].p_chLine);
+        vDebugDraw(&dd, TRUE);
 
-    /* Add the new line. */
-    strcpy(aa_charPrinted[DBG_SCRN_PRNTR_HEIGHT - 1], a_chPrint);
+        if (fSimRunning())
+            vSimTrace("PRINTER", 0, a_pl[j].p_chLine, (int)strlen(a_pl[j].p_chLine));
 
-    /* Note that we need to interrupt. */
-    iPrinting = 4;
+        vDebugInjectSeen(INJECT_OUT_PRINT, a_pl[j].p_chLine);
+    }
 
-    /* Redraw the printer */
-    vUtilityPrinterDisplay();
+    /* Interrupt once the whole batch would have been printed, at the
+       speed the simulated hardware is running. */
+    if (fSimRunning())
+    {
+        /* The simulation says when. */
+        vSimPrinterStarted(iCount, iPrinterLinesPerSecond);
+        xTicks = 0;
+    }
+    else if (iTimerScale() == TIMER_SCALE_MAX)
+        xTicks = 1;
+    else
+        xTicks = pdMS_TO_TICKS(iCount * 1000 /
+            (iPrinterLinesPerSecond * iTimerScale())) + 1;
+    if (xTicks != 0)
+    {
+        ullPrinterDueAt = ullStatsMicroseconds() +
+            (unsigned long long)xTicks * portTICK_PERIOD_MS * 1000ULL;
+        xTimerChangePeriod(xPrinterTimer, xTicks, 0);
+    }
 }
 
-static void gotoxy(int x, int y) {
-    COORD pos = { x, y};
+int iHardwarePrinterBufferLines(void) {
+    return(iPrinterBufferLines);
+}
+
+/* The floats have answered. */
+static void vDebugFloatsDone(TimerHandle_t xTimer) {
+
+    (void)xTimer;
+
+    /* Unless a key press or the deadline got there first */
+    if (iTankToRead != NO_TANK)
+        vFloatInterrupt();
+}
+
+/* A 1/3-second tick has gone by; the floats answer if they are due
+   to on this tick. */
+static void vDebugFloatsTick(void) {
+
+    if (fFloatsDue && iTankToRead != NO_TANK)
+        vFloatInterrupt();
+}
+
+/* The printer has finished its batch. */
+static void vDebugPrinterDone(TimerHandle_t xTimer) {
+
+    unsigned long long ullNow;
+
+    (void)xTimer;
+
+    /* Note how late the timer went off. */
+    ullNow = ullStatsMicroseconds();
+    vStatsHistAdd(&shPrinterLate,
+        (unsigned long)(ullNow > ullPrinterDueAt ? ullNow - ullPrinterDueAt : 0));
+
+    vPrinterInterrupt();
+}
+
+/* Draws what the rest of the system asks for.  It runs below
+   everything but the simulation, so drawing never holds up the
+   system; each time it wakes it draws every command waiting, then
+   sends the console one frame.  The screen is its alone, once the
+   scheduler starts. */
+static void vDebugRenderTask(void* pvParameters) {
+
+    DBG_DRAW dd;
+
+    /* Prevent the compiler warning about the unused parameter. */
+    (void)pvParameters;
+
+    for (;;) {
+        while (fDebugDrawTake(&dd))
+            vUtilityRender(&dd);
+        vUtilityFlush();
+
+        if (fDebugExit)
+        {
+            vDebugReportStats();
+            exit(0);
+        }
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+/* Hands a command to the renderer.  When the queue is full, a task
+   that may wait tries again a tick later; anything else, such as the
+   keyboard handler or code running with interrupts off, drops the
+   command.  While the simulation runs, a task that waits must not
+   sleep, or the simulation would move its clock on meanwhile; the
+   renderer is lifted to the waiting task's priority until it has
+   drained the queue instead. */
+static void vDebugDraw(DBG_DRAW* p_dd, BOOL fMayWait) {
+
+    vTimeGet(p_dd->a_iTime);
+
+    while (!fDebugDrawPost(p_dd))
+    {
+        if (!fMayWait)
+        {
+            InterlockedIncrement(&lDrawDropped);
+            return;
+        }
+        InterlockedIncrement(&lDrawWaits);
+        if (fSimRunning() && uxTaskPriorityGet(NULL) > TASK_PRIORITY_DEBUG_RENDER)
+        {
+            xTaskNotifyGive(xRenderTask);
+            vTaskPrioritySet(xRenderTask, uxTaskPriorityGet(NULL));
+            taskYIELD();
+            vTaskPrioritySet(xRenderTask, TASK_PRIORITY_DEBUG_RENDER);
+        }
+        else if (fSimRunning())
+        {
+            /* Below the renderer, which runs as soon as it is told to */
+            xTaskNotifyGive(xRenderTask);
+        }
+        else
+            vTaskDelay(1);
+    }
+    InterlockedIncrement(&lDrawPosted);
+
+    if (fMayWait)
+        xTaskNotifyGive(xRenderTask);
+    else
+        vTaskNotifyGiveFromISR(xRenderTask, NULL);
+}
+
+/***** fDebugDrawPost ***********************************************
+
+This routine puts a command in the renderer's queue without locking.
+It claims the slot at lDrawHead if the renderer has emptied it, by
+moving lDrawHead on with a compare-exchange; if another caller got
+there first, it tries the next one.  Once the command is in the slot,
+setting its lSeq hands it to the renderer.
+
+RETURNS: TRUE if the command is queued, FALSE if the queue is full.
+*/
+
+static BOOL fDebugDrawPost(const DBG_DRAW* p_dd)
+{
+    /* LOCAL VARIABLES: */
+    LONG lPos;      /* The slot to claim. */
+    LONG lSeq;      /* Its sequence number. */
+    LONG lWas;      /* lDrawHead, before trying to move it. */
+    DBG_DRAW_SLOT* p_ds;  /* The slot. */
+
+    /*-------------------------------------------------------*/
+
+    lPos = lDrawHead;
+    for (;;)
+    {
+        p_ds = &a_dsDraw[lPos & (DBG_DRAW_SLOTS - 1)];
+        lSeq = p_ds->lSeq;
+        MemoryBarrier();
+
+        if (lSeq == lPos)
+        {
+            /* Empty: take it, unless someone else just did. */
+            lWas = InterlockedCompareExchange(&lDrawHead,
+                (LONG)((DWORD)lPos + 1), lPos);
+            if (lWas == lPos)
+                break;
+            lPos = lWas;
+        }
+        else if ((LONG)((DWORD)lSeq - (DWORD)lPos) < 0)
+        {
+            /* The renderer has not emptied it yet: the queue is full. */
+            return(FALSE);
+        }
+        else
+        {
+            /* Someone else has filled it; look again. */
+            lPos = lDrawHead;
+        }
+    }
+
+    p_ds->dd = *p_dd;
+    MemoryBarrier();
+    p_ds->lSeq = (LONG)((DWORD)lPos + 1);
+    return(TRUE);
+}
+
+/* Takes the next command from the queue, for the renderer alone.
+   Returns FALSE if there is none, or if whoever claimed it has not
+   finished putting it in; that caller wakes the renderer again. */
+static BOOL fDebugDrawTake(DBG_DRAW* p_dd) {
+
+    DBG_DRAW_SLOT* p_ds;
+
+    p_ds = &a_dsDraw[lDrawTail & (DBG_DRAW_SLOTS - 1)];
+    if (p_ds->lSeq != (LONG)((DWORD)lDrawTail + 1))
+        return(FALSE);
+    MemoryBarrier();
+
+    *p_dd = p_ds->dd;
+    MemoryBarrier();
+
+    /* Hand the slot back for the next lap. */
+    p_ds->lSeq = (LONG)((DWORD)lDrawTail + DBG_DRAW_SLOTS);
+    lDrawTail = (LONG)((DWORD)lDrawTail + 1);
+    return(TRUE);
+}
+
+/* Draws one command into the screen, and logs it when running
+   headless. */
+static void vUtilityRender(const DBG_DRAW* p_dd) {
+
+    int i;
+
+    switch (p_dd->byOp)
+    {
+    case DBG_DRAW_DISPLAY:
+        if (p_dd->byArg)
+        {
+            gotoxy(DBG_SCRN_DISP_X + 1, DBG_SCRN_DISP_Y + 1);
+            vUtilityDraw(" ");
+            strcpy(a_chDisplayShown, p_dd->a_chText);
+        }
+        else
+        {
+            /* Keep the whole line for the log */
+            while ((int)strlen(a_chDisplayShown) < p_dd->sColumn + (int)strlen(p_dd->a_chText))
+                strcat(a_chDisplayShown, " ");
+            memcpy(a_chDisplayShown + p_dd->sColumn, p_dd->a_chText, strlen(p_dd->a_chText));
+        }
+        gotoxy(DBG_SCRN_DISP_X + 1 + p_dd->sColumn, DBG_SCRN_DISP_Y + 1);
+        vUtilityDraw("%s", p_dd->a_chText);
+        vUtilityLog("DISPLAY", a_chDisplayShown, p_dd->a_iTime);
+        break;
+
+    case DBG_DRAW_BELL:
+        /* Red for on, plain text for off */
+        setTextBackgroundColor(p_dd->byArg ? RED : BLACK);
+        gotoxy(DBG_SCRN_BELL_X + 1, DBG_SCRN_BELL_Y + 2);
+        vUtilityDraw(" BELL ");
+        setTextBackgroundColor(BLACK);
+        vUtilityLog("BELL", p_dd->byArg ? "ON" : "OFF", p_dd->a_iTime);
+        break;
+
+    case DBG_DRAW_PRINTER:
+        /* Move all the old lines up, and add the new one. */
+        for (i = 1; i < DBG_SCRN_PRNTR_HEIGHT; ++i)
+            strcpy(aa_charPrinted[i - 1], aa_charPrinted[i]);
+        strcpy(aa_charPrinted[DBG_SCRN_PRNTR_HEIGHT - 1], p_dd->a_chText);
+        vUtilityPrinterDisplay();
+        vUtilityLog("PRINTER", p_dd->a_chText, p_dd->a_iTime);
+        break;
+
+    case DBG_DRAW_BUTTON:
+        setTextBackgroundColor(p_dd->byArg);
+        gotoxy(DBG_SCRN_BTN_X + p_dd->sColumn * DBG_SCRN_BTN_WIDTH,
+            DBG_SCRN_BTN_Y + p_dd->sRow * DBG_SCRN_BTN_HEIGHT);
+        vUtilityDraw("%s", p_chButtonText[p_dd->sRow][p_dd->sColumn]);
+        setTextBackgroundColor(BLACK);
+        break;
+
+    case DBG_DRAW_AUTOTIME:
+        gotoxy(15, DBG_SCRN_TIME_ROW + 3);
+        setTextBackgroundColor(p_dd->byArg ? GREEN : RED);
+        vUtilityDraw(p_dd->byArg ? " ON  " : " OFF ");
+        setTextBackgroundColor(BLACK);
+        break;
+
+    case DBG_DRAW_FLOATS:
+        vUtilityDisplayFloatLevels();
+        break;
+
+    case DBG_DRAW_SPEED:
+        vUtilityDisplaySpeed();
+        break;
+    }
+}
+
+/* Draws on the screen, unless running headless.  The text goes
+   into the cells at the drawing position, and reaches the console
+   with the next frame. */
+static void vUtilityDraw(const char* p_chFormat, ...) {
+    va_list args;
+    char a_chText[DBG_SCRN_WIDTH + 1];
+    int i;
+
+    if (fHeadless)
+        return;
+
+    ++ulScreenCalls;
+
+    va_start(args, p_chFormat);
+    vsnprintf(a_chText, sizeof(a_chText), p_chFormat, args);
+    va_end(args);
+
+    for (i = 0; a_chText[i] != '\0'; ++i, ++iDrawX)
+    {
+        if (iDrawX >= 0 && iDrawX < DBG_SCRN_WIDTH &&
+            iDrawY >= 0 && iDrawY < DBG_SCRN_HEIGHT)
+        {
+            aa_cellDrawn[iDrawY][iDrawX].ch = a_chText[i];
+            aa_cellDrawn[iDrawY][iDrawX].byColor = byDrawColor;
+        }
+    }
+}
+
+/***** vUtilityFlush ************************************************
+
+This routine sends the console the cells that have changed since the
+last frame, in one write.  On Windows that is the smallest rectangle
+holding every change; elsewhere it is just the changed cells, with
+only the cursor moves and color changes they need.  Only the renderer
+task calls this, once the scheduler has started.
+
+RETURNS: None.
+*/
+
+static void vUtilityFlush(void)
+{
+    /* LOCAL VARIABLES: */
+    unsigned long long ullStart;  /* When the frame began. */
+    int x, y;          /* Iterators. */
+    DBG_CELL* p_cell;  /* The cell being looked at. */
+#if defined(_WIN32)
+    SMALL_RECT srChanged;  /* Where the cells changed. */
+    COORD cFrameSize;  /* The shape of a_ciFrame. */
+    COORD cFrom;       /* Where srChanged starts in it. */
+#else
+    int iLength;       /* Bytes in the frame. */
+    int iColor;        /* ANSI color of a cell. */
+#endif
+
+    /*-------------------------------------------------------*/
+
+    if (fHeadless)
+        return;
+
+    ullStart = ullStatsMicroseconds();
+
+#if defined(_WIN32)
+    srChanged.Left = DBG_SCRN_WIDTH;
+    srChanged.Top = DBG_SCRN_HEIGHT;
+    srChanged.Right = -1;
+    srChanged.Bottom = -1;
+    for (y = 0; y < DBG_SCRN_HEIGHT; ++y)
+    {
+        for (x = 0; x < DBG_SCRN_WIDTH; ++x)
+        {
+            p_cell = &aa_cellDrawn[y][x];
+            if (p_cell->ch == aa_cellShown[y][x].ch &&
+                p_cell->byColor == aa_cellShown[y][x].byColor)
+                continue;
+
+            if (x < srChanged.Left)
+                srChanged.Left = x;
+            if (x > srChanged.Right)
+                srChanged.Right = x;
+            if (y < srChanged.Top)
+                srChanged.Top = y;
+            srChanged.Bottom = y;
+            aa_cellShown[y][x] = *p_cell;
+            ++ulScreenCells;
+        }
+    }
+
+    /* Nothing changed, so there is no frame. */
+    if (srChanged.Right < 0)
+        return;
+
+    for (y = srChanged.Top; y <= srChanged.Bottom; ++y)
+    {
+        for (x = srChanged.Left; x <= srChanged.Right; ++x)
+        {
+            p_cell = &aa_cellDrawn[y][x];
+            a_ciFrame[y * DBG_SCRN_WIDTH + x].Char.AsciiChar = p_cell->ch;
+            a_ciFrame[y * DBG_SCRN_WIDTH + x].Attributes =
+                wConsoleText | (p_cell->byColor << 4);
+        }
+    }
+
+    cFrameSize.X = DBG_SCRN_WIDTH;
+    cFrameSize.Y = DBG_SCRN_HEIGHT;
+    cFrom.X = srChanged.Left;
+    cFrom.Y = srChanged.Top;
+    WriteConsoleOutputA(hConsole, a_ciFrame, cFrameSize, cFrom, &srChanged);
+#else
+    iLength = 0;
+    for (y = 0; y < DBG_SCRN_HEIGHT; ++y)
+    {
+        for (x = 0; x < DBG_SCRN_WIDTH; ++x)
+        {
+            p_cell = &aa_cellDrawn[y][x];
+            if (p_cell->ch == aa_cellShown[y][x].ch &&
+                p_cell->byColor == aa_cellShown[y][x].byColor)
+                continue;
+
+            if (x != iShownX || y != iShownY)
+                iLength += sprintf(a_chFrame + iLength, "\x1b[%d;%dH", y + 1, x + 1);
+
+            // The console colors are blue, green, red from the low bit up;
+            // ANSI ones are red, green, blue
+            iColor = 40 + ((p_cell->byColor & RED) ? 1 : 0) +
+                ((p_cell->byColor & GREEN) ? 2 : 0) + ((p_cell->byColor & BLUE) ? 4 : 0);
+            if (iColor != iShownColor)
+                iLength += sprintf(a_chFrame + iLength, "\x1b[%dm", iColor);
+
+            a_chFrame[iLength++] = p_cell->ch;
+            aa_cellShown[y][x] = *p_cell;
+            ++ulScreenCells;
+
+            /* A terminal may or may not wrap after the last column. */
+            iShownX = x + 1 < DBG_SCRN_WIDTH ? x + 1 : -1;
+            iShownY = y;
+            iShownColor = iColor;
+        }
+    }
+
+    /* Nothing changed, so there is no frame. */
+    if (iLength == 0)
+        return;
+
+    fwrite(a_chFrame, 1, iLength, stdout);
+    fflush(stdout);
+#endif
+
+    ++ulScreenFrames;
+    vStatsHistAdd(&shScreenFrame, (unsigned long)(ullStatsMicroseconds() - ullStart));
+}
+
+/* Sends the last frame, then leaves the console's cursor below the
+   screen, in plain colors, for text written straight to it. */
+static void vUtilityEndScreen(void) {
+    if (fHeadless)
+        return;
+
+    vUtilityFlush();
+
+#if defined(_WIN32)
+    COORD pos = { 0, DBG_SCRN_HEIGHT };
     SetConsoleCursorPosition(hConsole, pos);
+    SetConsoleTextAttribute(hConsole, wConsoleText);
+#else
+    printf("\x1b[0m\x1b[%d;1H", DBG_SCRN_HEIGHT + 1);
+    iShownX = -1;
+    iShownColor = -1;
+#endif
 }
 
-static void setTextBackgroundColor(int bgColor) {
-    CONSOLE_SCREEN_BUFFER_INFO consoleInfo;
+/* Writes one line of what the hardware did, and when, when running
+   headless. */
+static void vUtilityLog(const char* p_chWhat, const char* p_chText, const int* a_iTime) {
+    if (!fHeadless)
+        return;
+
+    printf("%02d:%02d:%02d.%d %-7s |%s|\n",
+        a_iTime[0], a_iTime[1], a_iTime[2], a_iTime[3], p_chWhat, p_chText);
+}
+
+/* Clears the console, and the screen to match it. */
+static void vUtilityClearScreen(void) {
+    int x, y;
+
+    if (fHeadless)
+        return;
+
+    for (y = 0; y < DBG_SCRN_HEIGHT; ++y)
+    {
+        for (x = 0; x < DBG_SCRN_WIDTH; ++x)
+        {
+            aa_cellDrawn[y][x].ch = ' ';
+            aa_cellDrawn[y][x].byColor = BLACK;
+            aa_cellShown[y][x] = aa_cellDrawn[y][x];
+        }
+    }
+
+#if defined(_WIN32)
+    system("cls");
+#else
+    printf("\x1b[0m\x1b[2J");
+    iShownX = -1;
+    iShownColor = -1;
+#endif
+}
 
-    // Get current console attributes (including text color)
-    GetConsoleScreenBufferInfo(hConsole, &consoleInfo);
-    WORD currentAttributes = consoleInfo.wAttributes;
+/* Moves where the next drawing goes. */
+static void gotoxy(int x, int y) {
+    if (fHeadless)
+        return;
+
+    ++ulScreenCalls;
+    iDrawX = x;
+    iDrawY = y;
+}
+
+/* Sets the color the next drawing goes on. */
+static void setTextBackgroundColor(int bgColor) {
+    if (fHeadless)
+        return;
 
-    // Mask out the old background color and apply the new one
-    WORD newAttributes = (currentAttributes & 0x0F) | (bgColor << 4);
-    SetConsoleTextAttribute(hConsole, newAttributes);
+    ++ulScreenCalls;
+    byDrawColor = (BYTE)bgColor;
 }
 
 static void hideCursor() {
+    if (fHeadless)
+        return;
 
+#if defined(_WIN32)
     CONSOLE_CURSOR_INFO cursorInfo;
 
     GetConsoleCursorInfo(hConsole, &cursorInfo);
     cursorInfo.bVisible = FALSE;  // Set the cursor visibility to false
     SetConsoleCursorInfo(hConsole, &cursorInfo);
+#else
+    printf("\x1b[?25l");
+#endif
 }
 
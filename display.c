@@ -8,8 +8,11 @@ This module deals with the Tank Monitor Display.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include <string.h>
+#include "tankport.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -20,183 +23,406 @@ This module deals with the Tank Monitor Display.
 #include "assert.h"
 
 /* Local Defines */
-#define MSG_UPDATE           0x0001
-#define MSG_DISP_RESET_ALARM 0x0002
-#define MSG_DISP_NO_PROMPT   0x0003
-#define MSG_DISP_OFLOW       0x0040
-#define MSG_DISP_LEAK        0x0080
-#define MSG_USER_REQUEST     0x8000
-#define MSG_DISP_TIME        (MSG_USER_REQUEST | 0x0001)
-#define MSG_DISP_TANK        (MSG_USER_REQUEST | 0x0400)
-#define MSG_DISP_PROMPT      (MSG_USER_REQUEST | 0x0800)
+/* Notification bits for the display task.  Producers set them
+   and return at once; any number of them between two renders
+   cost one render. */
+#define DISP_EVT_UPDATE      0x0001   /* The data shown may have changed */
+#define DISP_EVT_STATE       0x0002   /* What to show has changed */
+#define DISP_EVT_ALL         (DISP_EVT_UPDATE | DISP_EVT_STATE)
+
+/* Width of the display, in characters */
+#define DISP_WIDTH           20
+
+/* Kinds of alarm, in order of priority.  An alarm's number is
+   kind * COUNTOF_TANKS + tank, so a lower number is more urgent. */
+#define DISP_KIND_OFLOW      0
+#define DISP_KIND_LEAK       1
+#define DISP_KIND_LOW        2
+#define DISP_KIND_COUNT      3
+#define DISP_ALARMS          (DISP_KIND_COUNT * COUNTOF_TANKS)
+
+/* The alarm set is a three-level bitmap of 32-bit words.  A bit
+   in a higher level is set when any bit in the word below it is,
+   so finding an alarm looks at one word per level.  Alarm i is
+   bit 31 - (i % 32) of its word, so that counting leading zeros
+   finds the lowest-numbered alarm first. */
+#define DISP_ALARM_WORDS0    ((DISP_ALARMS + 31) / 32)
+#define DISP_ALARM_WORDS1    ((DISP_ALARM_WORDS0 + 31) / 32)
+#define DISP_ALARM_WORDS2    ((DISP_ALARM_WORDS1 + 31) / 32)
+#define DISP_ALARM_LEVELS    3
+#define DISP_ALARM_BIT(i)    (0x80000000UL >> ((i) & 31))
+
+#if DISP_ALARM_WORDS2 != 1
+#error Too many tanks for the display alarm set
+#endif
+
+/* Number of tanks on each page of the paged view: as many
+   "tank:level" cells, with a space between them, as fit across the
+   display.  Levels run up to four digits of gallons. */
+#define DISP_TANK_DIGITS     (COUNTOF_TANKS < 10 ? 1 : COUNTOF_TANKS < 100 ? 2 : \
+                              COUNTOF_TANKS < 1000 ? 3 : 4)
+#define DISP_LEVEL_DIGITS    4
+#define DISP_CELL_WIDTH      (DISP_TANK_DIGITS + 1 + DISP_LEVEL_DIGITS)
+#define DISP_PAGE_TANKS      ((DISP_WIDTH + 1) / (DISP_CELL_WIDTH + 1))
+#define DISP_LAST_PAGE       (((COUNTOF_TANKS - 1) / DISP_PAGE_TANKS) * DISP_PAGE_TANKS)
+
+#if DISP_PAGE_TANKS < 1
+#error The display is too narrow for a page of tanks
+#endif
+
+/* How long each alarm stays up when there are several */
+#define DISP_ALARM_DWELL     (2 * TIMER_TICKS_PER_SECOND)
+
+/* Local Structures */
+/* Everything the display task needs to decide what to show.
+   Producers change it with interrupts off. */
+typedef struct
+{
+    int iUserTank;       /* Tank the user asked to see, or NO_TANK for the time */
+    int iPageFirst;      /* First tank of the page on view, or NO_TANK */
+    int iPrompt;         /* Prompt to show, or -1 for none */
+} DISPLAY_STATE;
 
 static void vDisplayTask(void* pvParameters);
+static void vDisplayShow(char* a_chDisp);
+static void vDisplayPage(int iFirst, char* a_chDisp);
+static void vDisplayNotify(uint32_t ulEvent);
+static void vDisplayAlarmSet(int iAlarm);
+static void vDisplayAlarmClear(int iAlarm);
+static int iDisplayAlarmNext(int iFrom);
+static int iDisplayClz(uint32_t ul);
 
-/* The stack and input queue for the display task */
+/* The stack for the display task */
 #define STK_SIZE 1024
 //static UWORD DisplayTaskStk[STK_SIZE];
 
-#define Q_SIZE 10
-QueueHandle_t displayQueue;
-/*static OS_EVENT* QDisplayTask;
-static void* a_pvQDisplayData[Q_SIZE];*/
+/* The display task, for notifications */
+static TaskHandle_t xDisplayTask = NULL;
+
+/* What the display should show */
+static DISPLAY_STATE dst;
+
+/* The active alarms, and the number of them */
+static uint32_t a_ulAlarm0[DISP_ALARM_WORDS0];
+static uint32_t a_ulAlarm1[DISP_ALARM_WORDS1];
+static uint32_t a_ulAlarm2[DISP_ALARM_WORDS2];
+static uint32_t* const a_p_ulAlarm[DISP_ALARM_LEVELS] =
+    { a_ulAlarm0, a_ulAlarm1, a_ulAlarm2 };
+static const int a_iAlarmWords[DISP_ALARM_LEVELS] =
+    { DISP_ALARM_WORDS0, DISP_ALARM_WORDS1, DISP_ALARM_WORDS2 };
+static int iAlarmCount;
+
+/* The alarm on the display, or -1, and the tick it went up at */
+static int iAlarmShown = -1;
+static unsigned long long ullAlarmShownAt;
+
+/* The lines the display shows */
+static const FORMAT_FIELD a_ffTime[] =
+{
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2),
+    FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTankLevel[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": "), FORMAT_INT,
+    FORMAT_TEXT(" gls."), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTankNoLevel[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": N/A."), FORMAT_END
+};
+static const FORMAT_FIELD a_ffPageCell[] =
+{
+    FORMAT_INT, FORMAT_TEXT(":"), FORMAT_INT, FORMAT_END
+};
+static const FORMAT_FIELD a_ffPageCellNoLevel[] =
+{
+    FORMAT_INT, FORMAT_TEXT(":--"), FORMAT_END
+};
+static const FORMAT_FIELD a_ffOverflow[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": OVERFLOW!!"), FORMAT_END
+};
+static const FORMAT_FIELD a_ffLeak[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": LEAKING!!"), FORMAT_END
+};
+static const FORMAT_FIELD a_ffLow[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": LOW"), FORMAT_END
+};
+
+/* What each kind of alarm looks like */
+static const FORMAT_FIELD* const a_p_ffAlarm[DISP_KIND_COUNT] =
+{
+    a_ffOverflow,
+    a_ffLeak,
+    a_ffLow
+};
+
+/* What the display is showing now, padded with spaces */
+static char a_chShown[DISP_WIDTH + 1];
+
+/* Counts of hardware writes made and avoided */
+static DISPLAY_STATS dsStats;
 
 void vDisplaySystemInit(/*INPUTS:*/void) {
 
-    displayQueue = xQueueCreate(Q_SIZE, sizeof(WORD));
+    dst.iUserTank = NO_TANK;
+    dst.iPageFirst = NO_TANK;
+    dst.iPrompt = -1;
 
-    xTaskCreate(vDisplayTask, "displaytask", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DISPLAY, NULL);
+    xTaskCreate(vDisplayTask, "displaytask", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_DISPLAY, &xDisplayTask);
+
+    /* The time on the display changes once a second */
+    iTimerRegister(vDisplayUpdate, TIMER_TICKS_PER_SECOND, TRUE);
 }
 
 static void vDisplayTask(void* pvParameters) {
 
-    WORD wMsg;
+    uint32_t ulEvents;
+    DISPLAY_STATE ds;
+    int iAlarm;
+    int iNext;
     int a_iTime[4];
     char a_chDisp[21];
-    WORD wUserRequest;
-    int iLevel;
-    int iTankLeaking;
-    int iTankOverflow;
-    int iPrompt;
+    int a_iArgs[2];
 
     /* Initialize the display */
     vTimeGet(a_iTime);
-    sprintf(a_chDisp, "%02d:%02d:%02d", a_iTime[0], a_iTime[1], a_iTime[2]);
-    vHardwareDisplayLine(a_chDisp);
-    wUserRequest = MSG_DISP_TIME;
-
-    iTankLeaking = NO_TANK;
-    iTankOverflow = NO_TANK;
-    iPrompt = -1;
+    iFormat(a_chShown, a_ffTime, a_iTime);
+    memset(a_chShown + strlen(a_chShown), ' ', DISP_WIDTH - strlen(a_chShown));
+    a_chShown[DISP_WIDTH] = '\0';
+    vHardwareDisplayLine(a_chShown);
+    ++dsStats.ulWritesIssued;
+    dsStats.ulCellsWritten += DISP_WIDTH;
 
     while (TRUE) {
-        xQueueReceive(displayQueue, &wMsg, portMAX_DELAY);
-        //printf("msg: %d ", wMsg);
+        /* Wait for something to change, and take every change so far */
+        xTaskNotifyWait(0, DISP_EVT_ALL, &ulEvents, portMAX_DELAY);
 
-        if (wMsg & MSG_USER_REQUEST)
-        {
-            //if (wMsg & MSG_USER_REQUEST & MSG_DISP_PROMPT)
-            if ((wMsg & (MSG_USER_REQUEST | MSG_DISP_PROMPT)) == MSG_DISP_PROMPT)
-            {
-                /* Store the prompt weve been asked to display */
-                //iPrompt = !wMsg & !MSG_DISP_PROMPT; // change to wMsg && 0x000F or something similar to extract lower x bits
-                iPrompt = wMsg & 0x0001;
-                //printf("%d %d %d", iPrompt, wMsg, MSG_DISP_PROMPT);
-                //printf("pr: %d ", iPrompt);
-                //while (TRUE);
+        taskENTER_CRITICAL();
+        ds = dst;
+        ++dsStats.ulWakeups;
 
-            }
-            else
-            {
-                /* Store what the user asked us to display */
-                wUserRequest = wMsg;
-            }
-        }
-        else if (wMsg & MSG_DISP_LEAK)
+        /* When there are several alarms, move on to the next one
+           once this one has been up long enough */
+        if (iAlarmShown >= 0 && iAlarmCount > 1 &&
+            ullTimeNowTicks() - ullAlarmShownAt >= DISP_ALARM_DWELL)
         {
-            /* Store the number of the leaking tank */
-            iTankLeaking = wMsg - MSG_DISP_LEAK;
+            iNext = iDisplayAlarmNext(iAlarmShown + 1);
+            if (iNext < 0)
+                iNext = iDisplayAlarmNext(0);
+            iAlarmShown = iNext;
+            ullAlarmShownAt = ullTimeNowTicks();
         }
-        else if (wMsg & MSG_DISP_OFLOW)
-        {
-            /* Store the number of the overflowing tank */
-            iTankOverflow = wMsg - MSG_DISP_OFLOW;
-        }
-        else if (wMsg == MSG_DISP_RESET_ALARM)
-        {
-            iTankLeaking = NO_TANK;
-            iTankOverflow = NO_TANK;
-            iPrompt = -1;
-        }
-        else if (wMsg == MSG_DISP_NO_PROMPT)
-        {
-            iPrompt = -1;
-        }
-        //printf("%d", iPrompt);
-        //if (wUserRequest == MSG_DISP_TIME)
-        //    printf("MSG_DISP_TIME");
-        //while (TRUE);
+        iAlarm = iAlarmShown;
+        taskEXIT_CRITICAL();
 
-        /* ELSE its an update message */
         /* Now do the display */
-        if (iTankOverflow != NO_TANK)
+        if (iAlarm >= 0)
         {
-            /* A tank is overflowing. This takes priority */
-            sprintf(a_chDisp, "Tank %d: OVERFLOW!!", iTankOverflow + 1);
+            /* Alarms take priority */
+            a_iArgs[0] = iAlarm % COUNTOF_TANKS + 1;
+            iFormat(a_chDisp, a_p_ffAlarm[iAlarm / COUNTOF_TANKS], a_iArgs);
         }
-        else if (iTankLeaking != NO_TANK)
+        else if (ds.iPrompt >= 0)
         {
-            /* A tank is leaking. */
-            sprintf(a_chDisp, "Tank %d: LEAKING!!", iTankLeaking + 1);
+            strcpy(a_chDisp, p_chGetCommandPrompt(ds.iPrompt));
         }
-        else if (iPrompt >= 0)
+        else if (ds.iPageFirst != NO_TANK)
         {
-            //while (TRUE);
-            sprintf(a_chDisp, p_chGetCommandPrompt(iPrompt));
+            /* Display a page of tanks */
+            vDisplayPage(ds.iPageFirst, a_chDisp);
         }
-        else if (wUserRequest == MSG_DISP_TIME)
+        else if (ds.iUserTank == NO_TANK)
         {
             /* Display the time */
             vTimeGet(a_iTime);
-            sprintf(a_chDisp, "%02d:%02d:%02d           ",
-                a_iTime[0], a_iTime[1], a_iTime[2]);
-            //printf("%d", iPrompt);
-            //while (TRUE);
+            iFormat(a_chDisp, a_ffTime, a_iTime);
         }
         else
         {
             /* User must want tank level displayed. Get a level */
-            if (iTankDataGet(wUserRequest - MSG_DISP_TANK, &iLevel, NULL, 1) == 1)
+            a_iArgs[0] = ds.iUserTank + 1;
+            if (iTankDataGet(ds.iUserTank, &a_iArgs[1], NULL, 1) == 1)
             {
                 /* We have data for this tank; display it */
-                sprintf(a_chDisp, "Tank %d: %d gls.", wUserRequest - MSG_DISP_TANK + 1, iLevel);
+                iFormat(a_chDisp, a_ffTankLevel, a_iArgs);
             }
             else
             {
                 /* A level for this tank is not yet available */
-                sprintf(a_chDisp, "Tank %d: N/A.", wUserRequest - MSG_DISP_TANK + 1);
+                iFormat(a_chDisp, a_ffTankNoLevel, a_iArgs);
             }
         }
      
-        vHardwareDisplayLine(a_chDisp);
-        //printf("vHardwareDisplayLine working");
-        //while (TRUE);
+        vDisplayShow(a_chDisp);
+    }
+}
+
+/* Builds the line for the page of tanks starting at iFirst, as
+   "tank:level" cells.  Only the tanks on the page are fetched, in
+   one call, so the cost does not grow with the number of tanks */
+static void vDisplayPage(int iFirst, char* a_chDisp) {
+
+    int a_iLevels[DISP_PAGE_TANKS];
+    int a_iArgs[2];
+    int iCount;
+    int i;
+    char* p_ch;
+
+    iCount = iTankDataGetLatest(iFirst, DISP_PAGE_TANKS, a_iLevels);
+
+    p_ch = a_chDisp;
+    *p_ch = '\0';
+    for (i = 0; i < iCount; ++i)
+    {
+        if (i > 0)
+            *p_ch++ = ' ';
+        a_iArgs[0] = iFirst + i + 1;
+        a_iArgs[1] = a_iLevels[i];
+        if (a_iLevels[i] == TANK_NO_LEVEL)
+            p_ch += iFormat(p_ch, a_ffPageCellNoLevel, a_iArgs);
+        else
+            p_ch += iFormat(p_ch, a_ffPageCell, a_iArgs);
+    }
+}
+
+/* Sends the display only the characters that differ from what it is
+   showing already, one write for each run of changed characters */
+static void vDisplayShow(char* a_chDisp) {
+
+    char a_chNew[DISP_WIDTH + 1];
+    int iLength;
+    int iColumn;
+    int iStart;
+
+    assert(strlen(a_chDisp) <= DISP_WIDTH);
+
+    /* Pad the new line out, so that it covers whatever was there */
+    iLength = strlen(a_chDisp);
+    memcpy(a_chNew, a_chDisp, iLength);
+    memset(a_chNew + iLength, ' ', DISP_WIDTH - iLength);
+    a_chNew[DISP_WIDTH] = '\0';
+
+    ++dsStats.ulRenders;
+    if (memcmp(a_chNew, a_chShown, DISP_WIDTH) == 0)
+    {
+        /* Nothing has changed */
+        ++dsStats.ulWritesSuppressed;
+        return;
     }
+
+    iColumn = 0;
+    while (iColumn < DISP_WIDTH)
+    {
+        if (a_chNew[iColumn] == a_chShown[iColumn])
+        {
+            ++iColumn;
+            continue;
+        }
+
+        /* Find the end of this run of changed characters */
+        iStart = iColumn;
+        while (iColumn < DISP_WIDTH && a_chNew[iColumn] != a_chShown[iColumn])
+            ++iColumn;
+
+        vHardwareDisplayChars(iStart, a_chNew + iStart, iColumn - iStart);
+        ++dsStats.ulWritesIssued;
+        dsStats.ulCellsWritten += iColumn - iStart;
+    }
+
+    memcpy(a_chShown, a_chNew, DISP_WIDTH + 1);
+}
+
+void vDisplayGetStats(DISPLAY_STATS* p_ds) {
+    taskENTER_CRITICAL();
+    *p_ds = dsStats;
+    taskEXIT_CRITICAL();
+}
+
+/* Wakes the display task.  Never blocks, and does nothing if the
+   same event is already waiting to be handled */
+static void vDisplayNotify(uint32_t ulEvent) {
+    taskENTER_CRITICAL();
+    ++dsStats.ulNotifications;
+    taskEXIT_CRITICAL();
+
+    if (xDisplayTask != NULL)
+        xTaskNotify(xDisplayTask, ulEvent, eSetBits);
 }
 
 void vDisplayUpdate(void) {
-    WORD msg = MSG_UPDATE;
-    xQueueSend(displayQueue,&msg,portMAX_DELAY);
+    vDisplayNotify(DISP_EVT_UPDATE);
 }
 
 void vDisplayTankLevel(int iTank) {
     assert(iTank >= 0 && iTank < COUNTOF_TANKS);
-    WORD msg = MSG_DISP_TANK + iTank;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    taskENTER_CRITICAL();
+    dst.iUserTank = iTank;
+    dst.iPageFirst = NO_TANK;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
 }
 
 void vDisplayTime(void) {
-    WORD msg = MSG_DISP_TIME;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    taskENTER_CRITICAL();
+    dst.iUserTank = NO_TANK;
+    dst.iPageFirst = NO_TANK;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
+}
+
+/* Shows the first page of tanks, or the page after the one on view,
+   going back to the first after the last */
+void vDisplayNextPage(void) {
+    taskENTER_CRITICAL();
+    if (dst.iPageFirst == NO_TANK)
+        dst.iPageFirst = 0;
+    else
+        dst.iPageFirst += DISP_PAGE_TANKS;
+    if (dst.iPageFirst >= COUNTOF_TANKS)
+        dst.iPageFirst = 0;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
+}
+
+/* Shows the last page of tanks, or the page before the one on view,
+   going round to the last before the first */
+void vDisplayPrevPage(void) {
+    taskENTER_CRITICAL();
+    if (dst.iPageFirst == NO_TANK || dst.iPageFirst == 0)
+        dst.iPageFirst = DISP_LAST_PAGE;
+    else
+        dst.iPageFirst -= DISP_PAGE_TANKS;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
 }
 
 void vDisplayPrompt(int iPrompt) {
-    assert(iPrompt < 0x400);
-    WORD msg = MSG_DISP_PROMPT + iPrompt;
-    //printf("%d %d", iPrompt, MSG_DISP_PROMPT);
-    //while (TRUE);
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    assert(iPrompt >= 0);
+    taskENTER_CRITICAL();
+    dst.iPrompt = iPrompt;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
 }
 
 void vDisplayNoPrompt(void) {
-    WORD msg = MSG_DISP_NO_PROMPT;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    taskENTER_CRITICAL();
+    dst.iPrompt = -1;
+    taskEXIT_CRITICAL();
+    vDisplayNotify(DISP_EVT_STATE);
 }
 
 void vDisplayLeak(int iTank) {
     assert(iTank >= 0 && iTank < COUNTOF_TANKS);
-    WORD msg = MSG_DISP_LEAK + iTank;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    vDisplayAlarmSet(DISP_KIND_LEAK * COUNTOF_TANKS + iTank);
+}
+
+void vDisplayLow(int iTank) {
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+    vDisplayAlarmSet(DISP_KIND_LOW * COUNTOF_TANKS + iTank);
 }
 
 /* This routine is called when an overflow is detected */
@@ -204,11 +430,133 @@ void vDisplayOverflow(int iTank)
 {
     /* Check that the parameter is valid */
     assert(iTank >= 0 && iTank < COUNTOF_TANKS);
-    WORD msg = MSG_DISP_OFLOW + iTank;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
+    vDisplayAlarmSet(DISP_KIND_OFLOW * COUNTOF_TANKS + iTank);
+}
+
+/* Acknowledges the alarm on the display (DISP_ALARM_CURRENT) or
+   every alarm and any prompt (DISP_ALARM_ALL).  The bell goes
+   off once no alarms are left. */
+void vDisplayResetAlarm(int iWhich) {
+    int iCount;
+    int i;
+
+    assert(iWhich == DISP_ALARM_CURRENT || iWhich == DISP_ALARM_ALL);
+
+    taskENTER_CRITICAL();
+    if (iWhich == DISP_ALARM_ALL)
+    {
+        for (i = 0; i < DISP_ALARM_LEVELS; ++i)
+            memset(a_p_ulAlarm[i], 0, a_iAlarmWords[i] * sizeof(uint32_t));
+        iAlarmCount = 0;
+        iAlarmShown = -1;
+        dst.iPrompt = -1;
+    }
+    else if (iAlarmShown >= 0)
+    {
+        vDisplayAlarmClear(iAlarmShown);
+
+        /* Show the next alarm along, if there is one */
+        i = iDisplayAlarmNext(iAlarmShown);
+        if (i < 0)
+            i = iDisplayAlarmNext(0);
+        iAlarmShown = i;
+        ullAlarmShownAt = ullTimeNowTicks();
+    }
+    iCount = iAlarmCount;
+    taskEXIT_CRITICAL();
+
+    if (iCount == 0)
+        vHardwareBellOff();
+
+    vDisplayNotify(DISP_EVT_STATE);
 }
 
-void vDisplayResetAlarm(void) {
-    WORD msg = MSG_DISP_RESET_ALARM;
-    xQueueSend(displayQueue, &msg, portMAX_DELAY);
-}
\ No newline at end of file
+/* Adds an alarm to the set.  An alarm more urgent than the one
+   on the display replaces it at once; others wait their turn. */
+static void vDisplayAlarmSet(int iAlarm) {
+    assert(iAlarm >= 0 && iAlarm < DISP_ALARMS);
+
+    taskENTER_CRITICAL();
+    if ((a_ulAlarm0[iAlarm >> 5] & DISP_ALARM_BIT(iAlarm)) == 0)
+    {
+        a_ulAlarm0[iAlarm >> 5] |= DISP_ALARM_BIT(iAlarm);
+        a_ulAlarm1[iAlarm >> 10] |= DISP_ALARM_BIT(iAlarm >> 5);
+        a_ulAlarm2[iAlarm >> 15] |= DISP_ALARM_BIT(iAlarm >> 10);
+        ++iAlarmCount;
+
+        if (iAlarmShown < 0 || iAlarm < iAlarmShown)
+        {
+            iAlarmShown = iAlarm;
+            ullAlarmShownAt = ullTimeNowTicks();
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    vDisplayNotify(DISP_EVT_STATE);
+}
+
+/* Removes an alarm from the set.  Call with interrupts off. */
+static void vDisplayAlarmClear(int iAlarm) {
+    assert(iAlarm >= 0 && iAlarm < DISP_ALARMS);
+
+    if ((a_ulAlarm0[iAlarm >> 5] & DISP_ALARM_BIT(iAlarm)) == 0)
+        return;
+
+    --iAlarmCount;
+    a_ulAlarm0[iAlarm >> 5] &= ~DISP_ALARM_BIT(iAlarm);
+    if (a_ulAlarm0[iAlarm >> 5] == 0)
+    {
+        a_ulAlarm1[iAlarm >> 10] &= ~DISP_ALARM_BIT(iAlarm >> 5);
+        if (a_ulAlarm1[iAlarm >> 10] == 0)
+            a_ulAlarm2[iAlarm >> 15] &= ~DISP_ALARM_BIT(iAlarm >> 10);
+    }
+}
+
+/* Finds the lowest-numbered alarm at or after iFrom.  Climbs the
+   bitmap until a word has a bit at or after the place it started
+   from, then goes back down taking the first bit of each word.
+   Call with interrupts off.  Returns -1 if there is none. */
+static int iDisplayAlarmNext(int iFrom) {
+    int iLevel;
+    int iIndex;
+    int iWord;
+    uint32_t ul;
+
+    iIndex = iFrom;
+    for (iLevel = 0; iLevel < DISP_ALARM_LEVELS; ++iLevel)
+    {
+        iWord = iIndex >> 5;
+        if (iWord >= a_iAlarmWords[iLevel])
+            return(-1);
+
+        ul = a_p_ulAlarm[iLevel][iWord] & (0xFFFFFFFFUL >> (iIndex & 31));
+        if (ul != 0)
+        {
+            iIndex = (iWord << 5) + iDisplayClz(ul);
+            while (iLevel > 0)
+            {
+                --iLevel;
+                iIndex = (iIndex << 5) + iDisplayClz(a_p_ulAlarm[iLevel][iIndex]);
+            }
+            return(iIndex);
+        }
+
+        /* Nothing more in this word; try the words after it */
+        iIndex = iWord + 1;
+    }
+
+    return(-1);
+}
+
+/* Counts the zero bits above the highest set bit of a word that
+   is not zero */
+static int iDisplayClz(uint32_t ul) {
+#if defined(_MSC_VER)
+    unsigned long ulIndex;
+
+    _BitScanReverse(&ulIndex, ul);
+    return(31 - (int)ulIndex);
+#else
+    return(__builtin_clz(ul));
+#endif
+}
@@ -5,8 +5,7 @@ This module deals with the float hardware.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include "tankport.h"
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -19,10 +18,62 @@ This module deals with the float hardware.
 /* Local Defines */
 #define WAIT_FOREVER  0
 
+/* How long (in 1/3 seconds) the floats get to answer, and how often
+   we ask again.  The deadline runs on the same clock as the rest of
+   the system, so it keeps pace when the simulated hardware runs fast. */
+#define FLOAT_READ_TIMEOUT   TIMER_TICKS_PER_SECOND
+#define FLOAT_MAX_RETRIES    2
+
+/* How long to wait for the floats to be free.  Every read gives the
+   floats back within its deadlines, so this only trips on a bug, or
+   when the clock has stopped in the middle of a read.  A simulation
+   run waits as long as it takes, so that how fast the computer is
+   cannot change what happens. */
+#define FLOAT_BUS_TIMEOUT    pdMS_TO_TICKS((FLOAT_MAX_RETRIES + 2) * 1000)
+
+/* Local Structures */
+typedef struct
+{
+    int iLevel;          /* Last raw reading from the floats */
+    unsigned long long ullTick;  /* 1/3-second tick the reading was taken at */
+    BOOL fValid;         /* TRUE once the tank has been read at least once */
+} FLOAT_CACHE;
+
+typedef struct
+{
+    STATS_HIST shLatency;        /* 1/3-second ticks from setup to float
+                                    interrupt, on the deadline's clock */
+    unsigned long ulTimeouts;    /* Attempts that missed their deadline */
+    unsigned long ulStuck;       /* Reads abandoned after every retry */
+} FLOAT_TIMING;
+
+/* Static Functions */
+static void vFloatDeadline(void);
+static void vFloatStopClock(void);
+
 /* Static Data */
 static V_FLOAT_CALLBACK vFloatCallback = NULL;
 SemaphoreHandle_t xSemFloat;
 
+/* The tank whose floats the hardware is reading */
+static int iFloatTank = NO_TANK;
+
+/* The last reading from each of the tanks */
+static FLOAT_CACHE a_fc[COUNTOF_TANKS];
+
+/* Counters for the float cache */
+static FLOAT_STATS fsStats;
+
+/* When the current read started, and how often it has been retried */
+static unsigned long long ullFloatStart;
+static int iFloatRetries;
+
+/* The timer that catches floats that never answer, or TIMER_NONE */
+static int iFloatTimer = TIMER_NONE;
+
+/* Latency and failure counts for each of the tanks */
+static FLOAT_TIMING a_ft[COUNTOF_TANKS];
+
 /****** vFloatInit *****************************************
 This routine is the task that initializes the float routines.
 
@@ -30,6 +81,17 @@ RETURNS: None.
 ***********************************************************/
 void vFloatInit(void)
 {
+    int iTank;
+
+    /* Nothing has been read yet. */
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        a_fc[iTank].fValid = FALSE;
+        vStatsHistInit(&a_ft[iTank].shLatency);
+        a_ft[iTank].ulTimeouts = 0;
+        a_ft[iTank].ulStuck = 0;
+    }
+
     /* Initialize the semaphore that protects the data. */
     xSemFloat = xSemaphoreCreateBinary();
     xSemaphoreGive(xSemFloat);
@@ -46,9 +108,26 @@ void vFloatInterrupt(void)
     /* LOCAL VARIABLES */
     int iFloatLevel;
     V_FLOAT_CALLBACK vFloatCallbackTemp;
+    unsigned long long ullNow;
+
+    /* Ignore the floats if we have already given up on them. */
+    if (iFloatTank == NO_TANK)
+        return;
+
+    /* The read made its deadline. */
+    vFloatStopClock();
 
     /* Get the float level. */
     iFloatLevel = iHardwareFloatGetData();
+    ullNow = ullTimeNowTicks();
+    vStatsHistAdd(&a_ft[iFloatTank].shLatency,
+        (unsigned long)(ullNow - ullFloatStart));
+
+    /* Remember the reading for callers that can live with it. */
+    a_fc[iFloatTank].iLevel = iFloatLevel;
+    a_fc[iFloatTank].ullTick = ullNow;
+    a_fc[iFloatTank].fValid = TRUE;
+    iFloatTank = NO_TANK;
 
     /* Remember the callback function to call later. */
     vFloatCallbackTemp = vFloatCallback;
@@ -63,24 +142,185 @@ void vFloatInterrupt(void)
     vFloatCallbackTemp(iFloatLevel);
 }
 
-/****** vReadFloats *****************************************
-This routine is the task that initializes the float routines.
+/****** fFloatCached ****************************************
+This routine looks in the cache for a reading of a tank taken
+on or after a given 1/3-second tick.  The caller deals with the
+answer itself, so a hit never calls back into a task that may be
+the caller.
 
-RETURNS: None.
+RETURNS: TRUE, with the level and the tick it was read at, if
+the cache has one.
+***********************************************************/
+BOOL fFloatCached(
+    int iTankNumber,        /* The number of the tank. */
+    unsigned long long ullSince,  /* Oldest reading acceptable. */
+    int* p_iLevel,          /* Place to put the level. */
+    unsigned long long* p_ullTick)  /* Place to put when it was read. */
+{
+    /* LOCAL VARIABLES */
+    BOOL fHit;            /* TRUE if the cache can answer */
+
+    /* Check that the parameter is valid. */
+    assert(iTankNumber >= 0 && iTankNumber < COUNTOF_TANKS);
+
+    taskENTER_CRITICAL();
+    ++fsStats.ulRequests;
+    fHit = a_fc[iTankNumber].fValid
+        && a_fc[iTankNumber].ullTick >= ullSince;
+    if (fHit)
+    {
+        ++fsStats.ulCacheHits;
+        *p_iLevel = a_fc[iTankNumber].iLevel;
+        *p_ullTick = a_fc[iTankNumber].ullTick;
+    }
+    taskEXIT_CRITICAL();
+
+    return(fHit);
+}
+
+/****** fReadFloats *****************************************
+This routine starts a read of the floats in one tank.  The
+callback is always called later, from the float interrupt or
+the deadline, never from inside this routine.
+
+RETURNS: TRUE if the read has started, FALSE if the floats are
+wedged; the callback is not called then.
 ***********************************************************/
-void vReadFloats(
+BOOL fReadFloats(
     int iTankNumber,        /* The number of the tank to read. */
     V_FLOAT_CALLBACK vCb)   /* The function to call with the result. */
 {
-
     /* Check that the parameter is valid. */
     assert(iTankNumber >= 0 && iTankNumber < COUNTOF_TANKS);
 
-    xSemaphoreTake(xSemFloat, portMAX_DELAY);
+    /* The floats are wedged; do not wedge the caller too. */
+    if (xSemaphoreTake(xSemFloat,
+        fSimRunning() ? portMAX_DELAY : FLOAT_BUS_TIMEOUT) != pdTRUE)
+        return(FALSE);
 
     /* Set up the callback function */
+    taskENTER_CRITICAL();
     vFloatCallback = vCb;
+    iFloatTank = iTankNumber;
+    iFloatRetries = 0;
+    ullFloatStart = ullTimeNowTicks();
+    ++fsStats.ulHardwareReads;
+
+    /* Start the clock on the floats.  It goes off after every try,
+       until the floats answer or we give up on them. */
+    iFloatTimer = iTimerRegister(vFloatDeadline, FLOAT_READ_TIMEOUT, TRUE);
+    configASSERT(iFloatTimer != TIMER_NONE);
 
     /* Get the hardware started reading the value. */
     vHardwareFloatSetup(iTankNumber);
+    taskEXIT_CRITICAL();
+
+    return(TRUE);
+}
+
+/****** vFloatDeadline **************************************
+This routine is called by the timer each time the floats have
+not answered in time.  It asks them again, or after too many tries
+gives up and tells the caller that the read failed.
+
+RETURNS: None.
+***********************************************************/
+static void vFloatDeadline(void)
+{
+    /* LOCAL VARIABLES */
+    V_FLOAT_CALLBACK vFloatCallbackTemp;   /* Caller to tell of a failure */
+
+    vFloatCallbackTemp = NULL;
+
+    taskENTER_CRITICAL();
+    if (iFloatTank != NO_TANK)
+    {
+        /* Stop the floats looking, whatever happens next. */
+        ++a_ft[iFloatTank].ulTimeouts;
+        vHardwareFloatCancel();
+
+        if (iFloatRetries < FLOAT_MAX_RETRIES)
+        {
+            /* Try again. */
+            ++iFloatRetries;
+            vHardwareFloatSetup(iFloatTank);
+        }
+        else
+        {
+            /* This sensor is stuck. Give up on it. */
+            ++a_ft[iFloatTank].ulStuck;
+            iFloatTank = NO_TANK;
+            vFloatCallbackTemp = vFloatCallback;
+            vFloatCallback = NULL;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (vFloatCallbackTemp != NULL)
+    {
+        /* Stop the clock, and release the semaphore since we are no
+           longer using the floats. */
+        vFloatStopClock();
+        xSemaphoreGive(xSemFloat);
+        vFloatCallbackTemp(FLOAT_READ_FAILED);
+    }
+}
+
+/****** vFloatStopClock *************************************
+This routine stops the deadline timer of the read that has just
+ended, unless it has been stopped already.
+
+RETURNS: None.
+***********************************************************/
+static void vFloatStopClock(void)
+{
+    /* LOCAL VARIABLES */
+    int iTimer;           /* The timer to stop */
+
+    taskENTER_CRITICAL();
+    iTimer = iFloatTimer;
+    iFloatTimer = TIMER_NONE;
+    taskEXIT_CRITICAL();
+
+    if (iTimer != TIMER_NONE)
+        vTimerCancel(iTimer);
+}
+
+/****** vFloatGetStats **************************************
+This routine returns the counters for the float cache.
+
+RETURNS: None.
+***********************************************************/
+void vFloatGetStats(FLOAT_STATS* p_fs)   /* Place to put the counters. */
+{
+    taskENTER_CRITICAL();
+    *p_fs = fsStats;
+    taskEXIT_CRITICAL();
+}
+
+/****** vFloatGetLatency ************************************
+This routine returns the latency figures for one tank.
+
+RETURNS: None.
+***********************************************************/
+void vFloatGetLatency(
+    int iTank,                /* The tank to report on. */
+    FLOAT_LATENCY* p_fl)      /* Place to put the figures. */
+{
+    /* LOCAL VARIABLES */
+    FLOAT_TIMING ft;          /* Copy taken with interrupts off */
+
+    /* Check that the parameter is valid. */
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    taskENTER_CRITICAL();
+    ft = a_ft[iTank];
+    taskEXIT_CRITICAL();
+
+    p_fl->ulReads = ft.shLatency.ulCount;
+    p_fl->ulP50 = ulStatsHistPercentile(&ft.shLatency, 50);
+    p_fl->ulP99 = ulStatsHistPercentile(&ft.shLatency, 99);
+    p_fl->ulMax = ft.shLatency.ulMax;
+    p_fl->ulTimeouts = ft.ulTimeouts;
+    p_fl->ulStuck = ft.ulStuck;
 }
\ No newline at end of file
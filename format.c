@@ -0,0 +1,236 @@
+/****************************************************
+                          FORMAT.C
+This module builds the display and printer lines from
+fixed format templates, without going through printf.
+****************************************************/
+
+/* Standard includes. */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "tankport.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "publics.h"
+#include "assert.h"
+
+/* Local Defines */
+/* Enough room for the digits of any int */
+#define FORMAT_DIGITS_MAX  12
+
+/* How vFormatSelfTest checks and times iFormat */
+#define FORMAT_TEST_ARGS    4      /* Most numbers in any template */
+#define FORMAT_TEST_LINE    128    /* Longest line it can build */
+#define FORMAT_TEST_PASSES  20000  /* Times it builds every line for timing */
+
+/* Local Structures */
+typedef struct
+{
+    const FORMAT_FIELD* a_ff;      /* A template */
+    const char* p_chPrintf;        /* The same line as a printf format */
+} FORMAT_CHECK;
+
+/* Static Data */
+/* The templates the display and the printer use, and the formats
+   they used to sprintf */
+static const FORMAT_FIELD a_ffTestTime[] =
+{
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2),
+    FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestPrintTime[] =
+{
+    FORMAT_TEXT("Time: "), FORMAT_INT_ZERO(2), FORMAT_TEXT(":"),
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestTankLevel[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": "), FORMAT_INT,
+    FORMAT_TEXT(" gls."), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestTankNoLevel[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": N/A."), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestPageCell[] =
+{
+    FORMAT_INT, FORMAT_TEXT(":"), FORMAT_INT, FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestAlarm[] =
+{
+    FORMAT_TEXT("ALARM Tank "), FORMAT_INT, FORMAT_END
+};
+static const FORMAT_FIELD a_ffTestHistory[] =
+{
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2),
+    FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_TEXT(" "),
+    FORMAT_INT_SPACE(4), FORMAT_TEXT(" gls."), FORMAT_END
+};
+static const FORMAT_CHECK a_fcTest[] =
+{
+    { a_ffTestTime, "%02d:%02d:%02d" },
+    { a_ffTestPrintTime, "Time: %02d:%02d:%02d" },
+    { a_ffTestTankLevel, "Tank %d: %d gls." },
+    { a_ffTestTankNoLevel, "Tank %d: N/A." },
+    { a_ffTestPageCell, "%d:%d" },
+    { a_ffTestAlarm, "ALARM Tank %d" },
+    { a_ffTestHistory, "%02d:%02d:%02d %4d gls." }
+};
+
+/* The numbers each template is tried with: the edges of every
+   width, and of an int */
+static const int a_iTestValues[] =
+{
+    0, 1, 9, 10, 59, 99, 100, 999, 1000, 7500, 9999, 10000, 12345678,
+    INT_MAX, -1, -9, -10, -99, -100, -999, -1000, INT_MIN + 1, INT_MIN
+};
+#define FORMAT_TEST_VALUES  (int)(sizeof(a_iTestValues) / sizeof(a_iTestValues[0]))
+#define FORMAT_TEST_CHECKS  (int)(sizeof(a_fcTest) / sizeof(a_fcTest[0]))
+
+/****** iFormat *********************************************
+This routine builds a line from a template, taking the numbers
+from a_iArgs in order.  The output is the same, byte for byte,
+as sprintf would give for the equivalent format string: a
+FORMAT_INT_ZERO(2) field is "%02d" and FORMAT_INT_SPACE(4) is
+"%4d", negative numbers included.
+
+RETURNS: The length of the line, not counting the '\0'.
+***********************************************************/
+int iFormat(
+    char* a_chOut,                 /* Place to put the line. */
+    const FORMAT_FIELD* a_ff,      /* The template, ending in FORMAT_END. */
+    const int* a_iArgs)            /* The numbers for the INT fields. */
+{
+    /* LOCAL VARIABLES */
+    char a_chDigits[FORMAT_DIGITS_MAX];  /* Digits, least significant first */
+    char* p_ch;                    /* Next place in the output */
+    const char* p_chText;          /* Next character of a text field */
+    unsigned int uiValue;          /* The number, without its sign */
+    int iDigits;                   /* Count of digits in a_chDigits */
+    int iPad;                      /* Count of padding characters */
+    BOOL fNegative;                /* TRUE if the number is below 0 */
+
+    p_ch = a_chOut;
+    for (; a_ff->byKind != FMT_END; ++a_ff)
+    {
+        if (a_ff->byKind == FMT_TEXT)
+        {
+            for (p_chText = a_ff->p_chText; *p_chText != '\0'; ++p_chText)
+                *p_ch++ = *p_chText;
+            continue;
+        }
+
+        assert(a_ff->byKind == FMT_INT || a_ff->byKind == FMT_INT_ZERO ||
+            a_ff->byKind == FMT_INT_SPACE);
+
+        /* Work in unsigned so that INT_MIN comes out right. */
+        fNegative = *a_iArgs < 0;
+        uiValue = fNegative ? 0U - (unsigned int)*a_iArgs : (unsigned int)*a_iArgs;
+        ++a_iArgs;
+
+        iDigits = 0;
+        do
+        {
+            a_chDigits[iDigits++] = (char)('0' + uiValue % 10);
+            uiValue /= 10;
+        } while (uiValue != 0);
+
+        /* The width counts the sign, as it does for printf. */
+        iPad = a_ff->byWidth - iDigits - (fNegative ? 1 : 0);
+
+        if (a_ff->byKind == FMT_INT_SPACE)
+            for (; iPad > 0; --iPad)
+                *p_ch++ = ' ';
+        if (fNegative)
+            *p_ch++ = '-';
+        if (a_ff->byKind == FMT_INT_ZERO)
+            for (; iPad > 0; --iPad)
+                *p_ch++ = '0';
+        while (iDigits > 0)
+            *p_ch++ = a_chDigits[--iDigits];
+    }
+
+    *p_ch = '\0';
+    return((int)(p_ch - a_chOut));
+}
+
+/****** vFormatSelfTest *************************************
+This routine checks that iFormat gives sprintf's line, byte for
+byte, for every template the display and printer use, with
+every pair of the test numbers in the first two fields.  It
+then times building the same lines both ways.
+
+RETURNS: None.
+***********************************************************/
+void vFormatSelfTest(SELF_TEST* p_st)   /* Place to put the results. */
+{
+    /* LOCAL VARIABLES */
+    char a_chFormat[FORMAT_TEST_LINE];   /* Line from iFormat */
+    char a_chPrintf[FORMAT_TEST_LINE];   /* Line from sprintf */
+    int a_iArgs[FORMAT_TEST_ARGS];       /* The numbers for one line */
+    const FORMAT_CHECK* p_fc;            /* The template being checked */
+    unsigned long long ullStart;         /* Time the timing started */
+    int iFormatLength;                   /* Length from iFormat */
+    int iPrintfLength;                   /* Length from sprintf */
+    int iFirst;                          /* Iterator */
+    int iSecond;                         /* Iterator */
+    int iPass;                           /* Iterator */
+    int i;                               /* The usual iterator */
+
+    p_st->ulCases = 0;
+    p_st->ulFailures = 0;
+
+    for (p_fc = a_fcTest; p_fc < a_fcTest + FORMAT_TEST_CHECKS; ++p_fc)
+    {
+        for (iFirst = 0; iFirst < FORMAT_TEST_VALUES; ++iFirst)
+        {
+            for (iSecond = 0; iSecond < FORMAT_TEST_VALUES; ++iSecond)
+            {
+                a_iArgs[0] = a_iTestValues[iFirst];
+                a_iArgs[1] = a_iTestValues[iSecond];
+                for (i = 2; i < FORMAT_TEST_ARGS; ++i)
+                    a_iArgs[i] = a_iTestValues[(iFirst + iSecond + i) % FORMAT_TEST_VALUES];
+
+                /* sprintf ignores the numbers a format does not use. */
+                iFormatLength = iFormat(a_chFormat, p_fc->a_ff, a_iArgs);
+                iPrintfLength = sprintf(a_chPrintf, p_fc->p_chPrintf,
+                    a_iArgs[0], a_iArgs[1], a_iArgs[2], a_iArgs[3]);
+
+                ++p_st->ulCases;
+                if (iFormatLength != iPrintfLength
+                    || memcmp(a_chFormat, a_chPrintf, iPrintfLength + 1) != 0)
+                    ++p_st->ulFailures;
+            }
+        }
+    }
+
+    /* Time the lines the system really builds: times of day and
+       tank levels. */
+    for (i = 0; i < FORMAT_TEST_ARGS; ++i)
+        a_iArgs[i] = 0;
+
+    ullStart = ullStatsMicroseconds();
+    for (iPass = 0; iPass < FORMAT_TEST_PASSES; ++iPass)
+    {
+        a_iArgs[0] = iPass % 24;
+        a_iArgs[1] = iPass % 60;
+        a_iArgs[3] = iPass % 8000;
+        for (p_fc = a_fcTest; p_fc < a_fcTest + FORMAT_TEST_CHECKS; ++p_fc)
+            iFormat(a_chFormat, p_fc->a_ff, a_iArgs);
+    }
+    p_st->ullMicroseconds = ullStatsMicroseconds() - ullStart;
+
+    ullStart = ullStatsMicroseconds();
+    for (iPass = 0; iPass < FORMAT_TEST_PASSES; ++iPass)
+    {
+        a_iArgs[0] = iPass % 24;
+        a_iArgs[1] = iPass % 60;
+        a_iArgs[3] = iPass % 8000;
+        for (p_fc = a_fcTest; p_fc < a_fcTest + FORMAT_TEST_CHECKS; ++p_fc)
+            sprintf(a_chPrintf, p_fc->p_chPrintf,
+                a_iArgs[0], a_iArgs[1], a_iArgs[2], a_iArgs[3]);
+    }
+    p_st->ullBaseline = ullStatsMicroseconds() - ullStart;
+}
@@ -5,20 +5,23 @@ This module deals with calculating the tank levels.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include "tankport.h"
 #include <time.h>
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
-#include "timers.h"x
+#include "timers.h"
 #include "semphr.h"
 #include "publics.h"
 #include "assert.h"
 
 /* Local Defines */
+/* Simulated time the "calculation" takes */
+#define LEVELS_COMPUTE_SECONDS 2.0
+
 #define MSG_LEVEL_VALUE 1
+#define MSG_LEVEL_FAILED 0
 
 /* Static Functions */
 /* The function to call when the floats have finished. */
@@ -27,6 +30,7 @@ static void vTestFloatCallback(int iFloatLevel);
 
 /* The task. */
 static void vLevelsTask(void* pvParameters);
+static void vLevelsCheckAlarms(void);
 
 /* Static Data */
 /* Data for the message queue for the button task. */
@@ -36,6 +40,10 @@ QueueHandle_t QLevelsTask;
 //#define STK_SIZE 1024
 //static UWORD LevelsTaskStk[STK_SIZE];
 
+/* The alarms found by this scan and the one before */
+static BYTE a_byAlarms[COUNTOF_TANKS];
+static BYTE a_byAlarmsLast[COUNTOF_TANKS];
+
 /****** vLevelsSystemInit ***********************************
 This routine is the task that initializes the levels task.
 
@@ -58,10 +66,13 @@ RETURNS: None.
 static void vLevelsTask(void* pvParameters)
 {
     /* LOCAL VARIABLES */
-    BYTE byErr;           /* Error code back from the OS */
     WORD wFloatLevel;     /* Message received from the queue */
     int iTank;            /* Tank we're working on */
     int a_iLevels[3];     /* Levels for detecting leaks */
+    unsigned long long a_ullTicks[3];  /* When those levels were measured */
+    unsigned long ulTicks;  /* 1/3 seconds between the oldest and newest level */
+    int iLeakRate;        /* Gallons per hour the tank is falling */
+    double dCompute;      /* Real seconds the "calculation" takes */
 
     /* Prevent the compiler warning about the unused parameter. */
     (void)pvParameters;
@@ -71,45 +82,111 @@ static void vLevelsTask(void* pvParameters)
 
     while (TRUE)
     {
-        /* Get the floats looking for the level in this tank. */
-        vReadFloats(iTank, vFloatCallback);
-
-        /* Wait for the result. */
-        xQueueReceive(QLevelsTask, &wFloatLevel, portMAX_DELAY);
-
-        /* The "calculation" wastes about 2 seconds. */
-        clock_t start = clock();
-        while (((double)(clock() - start) / CLOCKS_PER_SEC) < 2.0) {
-            volatile int k = 0;
-            for (int i = 0; i < 1000; i += 2)
-                for (int j = 0; j < 1000; j += 2)
-                    if ((i + j) % 2 != 0)
-                        ++k;
-        }
+        /* Get the floats looking for the level in this tank. This
+           reading is what feeds the database, so it must be fresh. */
+        if (fReadFloats(iTank, vFloatCallback))
+            /* Wait for the result. */
+            xQueueReceive(QLevelsTask, &wFloatLevel, portMAX_DELAY);
+        else
+            wFloatLevel = MSG_LEVEL_FAILED;
+
+        /* If the floats did not answer, go on to the next tank. */
+        if (wFloatLevel != MSG_LEVEL_FAILED)
+        {
+            /* The "calculation" wastes about 2 seconds of simulated
+               time, which is less real time when the simulation is
+               running fast. */
+            dCompute = iTimerScale() == TIMER_SCALE_MAX ? 0.0 :
+                LEVELS_COMPUTE_SECONDS / iTimerScale();
+            clock_t start = clock();
+            while (((double)(clock() - start) / CLOCKS_PER_SEC) < dCompute) {
+                volatile int k = 0;
+                for (int i = 0; i < 1000; i += 2)
+                    for (int j = 0; j < 1000; j += 2)
+                        if ((i + j) % 2 != 0)
+                            ++k;
+            }
 
-        /* Now that the "calculation" is done, assume that
-           the number of gallons equals the float level. */
-        vTankDataAdd(iTank, wFloatLevel - 1);
+            /* Now that the "calculation" is done, assume that
+               the number of gallons equals the float level. */
+            vTankDataAdd(iTank, wFloatLevel - 1);
 
-        /* Now test for leaks (very simplistically). */
-        if (iTankDataGet(iTank, a_iLevels, NULL, 3) == 3)
-        {
-            /* We got three levels. Test if the levels go down consistently. */
-            if (a_iLevels[0] < a_iLevels[1] && a_iLevels[1] < a_iLevels[2])
+            /* Now work out how fast the tank is leaking (very simplistically). */
+            iLeakRate = 0;
+            if (iTankDataGet(iTank, a_iLevels, NULL, 3) == 3
+                && iTankDataGetTicks(iTank, a_ullTicks, 3) == 3)
             {
-                vHardwareBellOn();
-                vDisplayLeak(iTank);
+                /* We got three levels. Test if the levels go down consistently.
+                   The time between them comes from the tick count, which,
+                   unlike the time of day, does not wrap at midnight. */
+                if (a_iLevels[0] < a_iLevels[1] && a_iLevels[1] < a_iLevels[2])
+                {
+                    ulTicks = (unsigned long)(a_ullTicks[0] - a_ullTicks[2]);
+                    if (ulTicks == 0)
+                        ulTicks = 1;
+                    iLeakRate = (int)((long)(a_iLevels[2] - a_iLevels[0]) *
+                        3600L * TIMER_TICKS_PER_SECOND / (long)ulTicks);
+                    if (iLeakRate == 0)
+                        iLeakRate = 1;
+                }
+
+                /* If the tank is rising, watch for overflows. */
+                if (a_iLevels[0] > a_iLevels[1])
+                    vOverflowAddTank(iTank);
             }
-
-            /* If the tank is rising, watch for overflows. */
-            if (a_iLevels[0] > a_iLevels[1])
-                vOverflowAddTank(iTank);
+            vAlarmLevelSet(iTank, wFloatLevel - 1, iLeakRate);
         }
 
         /* Go to the next tank. */
         ++iTank;
         if (iTank == COUNTOF_TANKS)
+        {
+            /* We have been round all the tanks. Check the alarms. */
+            vLevelsCheckAlarms();
             iTank = 0;
+        }
+    }
+}
+
+/****** vLevelsCheckAlarms **********************************
+This routine checks all the tanks against their alarm
+thresholds and reports the alarms that have just tripped.
+
+RETURNS: None.
+***********************************************************/
+static void vLevelsCheckAlarms(void)
+{
+    /* LOCAL VARIABLES */
+    int iTank;            /* Tank iterator */
+    BYTE byNew;           /* Alarms that were not tripped last time */
+
+    vAlarmScan(a_byAlarms);
+
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        byNew = a_byAlarms[iTank] & ~a_byAlarmsLast[iTank];
+        a_byAlarmsLast[iTank] = a_byAlarms[iTank];
+        if (byNew == 0)
+            continue;
+
+        if (byNew & ALARM_HIGH_HIGH)
+        {
+            vHardwareBellOn();
+            vDisplayOverflow(iTank);
+            iPrintAlarm(iTank, ALARM_HIGH_HIGH);
+        }
+        if (byNew & ALARM_LEAK)
+        {
+            vHardwareBellOn();
+            vDisplayLeak(iTank);
+            iPrintAlarm(iTank, ALARM_LEAK);
+        }
+        if (byNew & ALARM_LOW)
+            vDisplayLow(iTank);
+
+        /* A nearly full tank needs watching closely. */
+        if (byNew & ALARM_HIGH)
+            vOverflowAddTank(iTank);
     }
 }
 
@@ -121,8 +198,9 @@ RETURNS: None.
 ***********************************************************/
 static void vFloatCallback(int iFloatLevel)
 {
-    /* Put that button on the queue for the task. */
-    WORD msg = iFloatLevel + MSG_LEVEL_VALUE;
+    /* Put that level on the queue for the task. */
+    WORD msg = iFloatLevel == FLOAT_READ_FAILED ?
+        MSG_LEVEL_FAILED : iFloatLevel + MSG_LEVEL_VALUE;
     xQueueSendToBack(QLevelsTask, &msg, portMAX_DELAY);
 }
 
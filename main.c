@@ -59,6 +59,7 @@
 /* FreeRTOS kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "publics.h"
 
 /* FreeRTOS+Trace includes. */
 #include "trcRecorder.h"
@@ -89,6 +90,15 @@
 #define mainOUTPUT_TRACE_KEY                  't'
 #define mainINTERRUPT_NUMBER_KEYBOARD         3
 
+/* Keys wait in a ring between the keyboard thread and the keyboard interrupt.
+ * The size must be a power of two. */
+#define mainKEY_RING_SIZE                     64
+#define mainKEY_RING_MASK                     ( mainKEY_RING_SIZE - 1 )
+
+/* How long, in milliseconds, the keyboard thread waits for room in a full
+ * ring before giving up on a key. */
+#define mainKEY_RING_WAIT_MS                  1000
+
 /* This demo allows to save a trace file. */
 #define mainTRACE_FILE_NAME                   "Trace.dump"
 
@@ -150,6 +160,7 @@ static DWORD WINAPI prvWindowsKeyboardInputThread( void * pvParam );
  * Interrupt handler for when keyboard input is received.
  */
 static uint32_t prvKeyboardInterruptHandler( void );
+static void prvKeyboardHandleKey( int xKeyPressed );
 
 /*
  * Keyboard interrupt handler for the blinky demo. 
@@ -169,11 +180,16 @@ StackType_t uxTimerTaskStack[ configTIMER_TASK_STACK_DEPTH ];
 /* Thread handle for the keyboard input Windows thread. */
 static HANDLE xWindowsKeyboardInputThreadHandle = NULL;
 
-/* This stores the last key pressed that has not been handled.
- * Keyboard input is retrieved by the prvWindowsKeyboardInputThread
- * Windows thread and stored here. This is then read by the idle
- * task and handled appropriately. */
-static int xKeyPressed = mainNO_KEY_PRESS_VALUE;
+/* Keys pressed that have not been handled.  The prvWindowsKeyboardInputThread
+ * Windows thread is the only writer of ulKeyRingHead, and the keyboard
+ * interrupt is the only writer of ulKeyRingTail, so no lock is needed.  Both
+ * count up forever; the slot is the count masked by mainKEY_RING_MASK. */
+static int xKeyRing[ mainKEY_RING_SIZE ];
+static volatile uint32_t ulKeyRingHead = 0;
+static volatile uint32_t ulKeyRingTail = 0;
+
+/* Counters for vKeyboardGetStats().  Each is written by one side only. */
+static KEY_STATS xKeyStats;
 
 /*-----------------------------------------------------------*/
 
@@ -468,6 +484,41 @@ void vApplicationGetTimerTaskMemory( StaticTask_t ** ppxTimerTaskTCBBuffer,
  * Interrupt handler for when keyboard input is received.
  */
 static uint32_t prvKeyboardInterruptHandler(void)
+{
+    uint32_t ulHead;
+    uint32_t ulKeysThisTime = 0;
+    int xKeyPressed;
+
+    ++xKeyStats.ulInterrupts;
+
+    /* Handle every key that has arrived, not just the one that raised the
+     * interrupt. */
+    ulHead = ulKeyRingHead;
+    MemoryBarrier();
+
+    while( ulKeyRingTail != ulHead )
+    {
+        xKeyPressed = xKeyRing[ ulKeyRingTail & mainKEY_RING_MASK ];
+        MemoryBarrier();
+        ulKeyRingTail = ulKeyRingTail + 1;
+
+        ++xKeyStats.ulKeys;
+        if( ulKeysThisTime++ > 0 )
+        {
+            ++xKeyStats.ulCoalesced;
+        }
+
+        prvKeyboardHandleKey( xKeyPressed );
+    }
+
+    /* This interrupt does not require a context switch so return pdFALSE */
+    return pdFALSE;
+}
+
+/*
+ * Handles one key for the keyboard interrupt.
+ */
+static void prvKeyboardHandleKey( int xKeyPressed )
 {
     /* Handle keyboard input. */
     switch (xKeyPressed)
@@ -496,9 +547,13 @@ static uint32_t prvKeyboardInterruptHandler(void)
         #endif
     break;
     }
+}
 
-    /* This interrupt does not require a context switch so return pdFALSE */
-    return pdFALSE;
+/*-----------------------------------------------------------*/
+
+void vKeyboardGetStats( KEY_STATS * p_ks )
+{
+    *p_ks = xKeyStats;
 }
 
 /*-----------------------------------------------------------*/
@@ -509,13 +564,41 @@ static uint32_t prvKeyboardInterruptHandler(void)
  */
 static DWORD WINAPI prvWindowsKeyboardInputThread( void * pvParam )
 {
+    int xKey;
+    int iWaited;
+
     ( void ) pvParam;
 
     for ( ; ; )
     {
         /* Block on acquiring a key press. */
-        xKeyPressed = _getch();
-        
+        xKey = _getch();
+
+        /* If the ring is full, give the interrupt a chance to empty it rather
+         * than overwrite a key it has not seen. */
+        if( ulKeyRingHead - ulKeyRingTail == mainKEY_RING_SIZE )
+        {
+            ++xKeyStats.ulFullWaits;
+            for( iWaited = 0;
+                 iWaited < mainKEY_RING_WAIT_MS && ulKeyRingHead - ulKeyRingTail == mainKEY_RING_SIZE;
+                 ++iWaited )
+            {
+                vPortGenerateSimulatedInterrupt( mainINTERRUPT_NUMBER_KEYBOARD );
+                Sleep( 1 );
+            }
+
+            if( ulKeyRingHead - ulKeyRingTail == mainKEY_RING_SIZE )
+            {
+                ++xKeyStats.ulDropped;
+                continue;
+            }
+        }
+
+        /* Fill the slot before making it visible to the interrupt. */
+        xKeyRing[ ulKeyRingHead & mainKEY_RING_MASK ] = xKey;
+        MemoryBarrier();
+        ulKeyRingHead = ulKeyRingHead + 1;
+
         /* Notify FreeRTOS simulator that there is a keyboard interrupt.
          * This will trigger prvKeyboardInterruptHandler.
          */
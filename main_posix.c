@@ -0,0 +1,192 @@
+/******************************************************************************
+ * This file does for the FreeRTOS POSIX/GCC port what main.c does for the
+ * Windows port: it provides main(), the FreeRTOS hook functions and the
+ * keyboard, then hands over to dbgmain().
+ *
+ * The Windows port raises a simulated interrupt for each key.  The POSIX
+ * port has no simulated interrupts, so a high priority task polls stdin
+ * instead and hands each key to the same handler.
+ *
+ * With TANK_HEADLESS in the environment nothing is drawn; the display, the
+ * printer and the bell are logged to stdout a line at a time, and keys can be
+ * piped in on stdin.
+ *******************************************************************************
+ */
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "tankport.h"
+
+/* FreeRTOS kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "publics.h"
+
+/* How often the keyboard task looks for keys. */
+#define mainKEY_POLL_PERIOD                   pdMS_TO_TICKS( 10 )
+
+/* The keyboard task runs above the system's tasks, as the keyboard interrupt
+ * does on Windows. */
+#define mainKEYBOARD_TASK_PRIORITY            ( configMAX_PRIORITIES - 2 )
+
+/*-----------------------------------------------------------*/
+
+extern void dbgmain( void );
+
+/*
+ * Prototypes for the standard FreeRTOS application hook (callback) functions.
+ */
+void vApplicationMallocFailedHook( void );
+void vAssertCalled( unsigned long ulLine,
+                    const char * const pcFileName );
+
+/*
+ * Polls stdin for keys and handles them.
+ */
+static void prvKeyboardTask( void * pvParameters );
+
+/*
+ * Puts the terminal back the way it was found.
+ */
+static void prvRestoreTerminal( void );
+
+/*-----------------------------------------------------------*/
+
+/* The terminal settings before the keyboard was put in raw mode. */
+static struct termios xTerminalWas;
+
+/* Counters for vKeyboardGetStats(). */
+static KEY_STATS xKeyStats;
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    struct termios xTerminal;
+
+    if( getenv( "TANK_HEADLESS" ) != NULL )
+    {
+        /* Each line of the log goes out as soon as it is complete. */
+        setvbuf( stdout, NULL, _IOLBF, 0 );
+    }
+    else
+    {
+        /* The screen is drawn a piece at a time, without newlines. */
+        setvbuf( stdout, NULL, _IONBF, 0 );
+
+        /* Take keys as they are pressed, without echoing them. */
+        if( isatty( STDIN_FILENO ) && ( tcgetattr( STDIN_FILENO, &xTerminalWas ) == 0 ) )
+        {
+            xTerminal = xTerminalWas;
+            xTerminal.c_lflag &= ~( ICANON | ECHO );
+            xTerminal.c_cc[ VMIN ] = 0;
+            xTerminal.c_cc[ VTIME ] = 0;
+            tcsetattr( STDIN_FILENO, TCSANOW, &xTerminal );
+        }
+
+        atexit( prvRestoreTerminal );
+    }
+
+    xTaskCreate( prvKeyboardTask, "keyboard", configMINIMAL_STACK_SIZE, NULL, mainKEYBOARD_TASK_PRIORITY, NULL );
+
+    dbgmain();
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+static void prvKeyboardTask( void * pvParameters )
+{
+    struct pollfd xPoll;
+    char cKey;
+    ssize_t xRead;
+    uint32_t ulKeysThisTime;
+
+    ( void ) pvParameters;
+
+    xPoll.fd = STDIN_FILENO;
+    xPoll.events = POLLIN;
+
+    for( ;; )
+    {
+        vTaskDelay( mainKEY_POLL_PERIOD );
+
+        /* Handle every key that has arrived since last time. */
+        ulKeysThisTime = 0;
+
+        while( poll( &xPoll, 1, 0 ) > 0 )
+        {
+            xRead = read( STDIN_FILENO, &cKey, 1 );
+
+            if( xRead == 1 )
+            {
+                ++xKeyStats.ulKeys;
+
+                if( ulKeysThisTime++ > 0 )
+                {
+                    ++xKeyStats.ulCoalesced;
+                }
+
+                vSimulationKeyboardInterruptHandler( cKey );
+            }
+            else if( ( xRead == 0 ) || ( errno != EINTR ) )
+            {
+                /* The input has ended, as it does when keys are piped in;
+                 * there will be no more. */
+                vTaskSuspend( NULL );
+            }
+        }
+
+        if( ulKeysThisTime > 0 )
+        {
+            ++xKeyStats.ulInterrupts;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vKeyboardGetStats( KEY_STATS * p_ks )
+{
+    *p_ks = xKeyStats;
+}
+/*-----------------------------------------------------------*/
+
+static void prvRestoreTerminal( void )
+{
+    /* Plain colours, and the cursor back on. */
+    printf( "\x1b[0m\x1b[?25h\n" );
+
+    if( isatty( STDIN_FILENO ) )
+    {
+        tcsetattr( STDIN_FILENO, TCSANOW, &xTerminalWas );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vApplicationMallocFailedHook( void )
+{
+    /* vApplicationMallocFailedHook() will only be called if
+     * configUSE_MALLOC_FAILED_HOOK is set to 1 in FreeRTOSConfig.h.  heap_3 is
+     * used, so this means malloc() itself has failed. */
+    vAssertCalled( __LINE__, __FILE__ );
+}
+/*-----------------------------------------------------------*/
+
+void vAssertCalled( unsigned long ulLine,
+                    const char * const pcFileName )
+{
+    /* Called if an assertion passed to configASSERT() fails.  There is no
+     * debugger to stop in, so say where and stop. */
+    taskENTER_CRITICAL();
+    {
+        printf( "ASSERT! Line %lu, file %s\n", ulLine, pcFileName );
+        abort();
+    }
+    taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
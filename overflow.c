@@ -5,8 +5,8 @@ This module deals with detecting overflows.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include <stdlib.h>
+#include "tankport.h"
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -17,23 +17,69 @@ This module deals with detecting overflows.
 #include "assert.h"
 
 /* Local Defines */
-#define MSG_OFLOW_TIME       0xC010
-#define MSG_OFLOW_ADD_TANK   0xC000
+#define MSG_OFLOW_TIME         0xC010
+#define MSG_OFLOW_ADD_TANK     0xC000
+#define MSG_OFLOW_LEVEL        0xC020
+#define MSG_OFLOW_FLOAT_FAILED 0x8000
+
+/* How long vOverflowBenchmark runs the wheel, in overflow ticks */
+#define OFLOW_BENCH_TICKS    (3 * 60)
 
 /* How long to watch tanks */
 #define OFLOW_WATCH_TIME     (3 * 10)
-#define OFLOW_THRESHOLD      7500
+
+/* How often (in 1/3 seconds) to read a tank that is being watched.
+   A rising tank is read again after half of its estimated time to
+   reach its high-high threshold, but never more often than OFLOW_CHECK_MIN nor
+   less often than OFLOW_CHECK_MAX.  A tank that is not rising is
+   read every OFLOW_CHECK_MAX. */
+#define OFLOW_CHECK_MIN      1
+#define OFLOW_CHECK_MAX      (3 * 5)
+#define OFLOW_CHECK_DIVISOR  2
+
+/* A reading taken within one overflow tick (1/3 second) is as good
+   as a new one */
+#define OFLOW_MAX_READING_AGE  1
+
+/* The timer wheel that holds the watched tanks.  Each slot holds
+   the tanks whose next check falls on a time with those low bits.
+   The number of slots must be a power of two. */
+#define OFLOW_WHEEL_SLOTS    64
+#define OFLOW_WHEEL_MASK     (OFLOW_WHEEL_SLOTS - 1)
+
+/* Where a tank is in the watch machinery */
+#define OFLOW_IDLE           0   /* Not being watched */
+#define OFLOW_WHEEL          1   /* Waiting in the wheel for its next check */
+#define OFLOW_READY          2   /* Due, waiting for the floats to be free */
+#define OFLOW_READING        3   /* The floats are reading it now */
 
 /* Local Structures */
 typedef struct
 {
-    int iTime;   /* Time (in 1/3 seconds) to watch this tank */
-    int iLevel;  /* Level last time this tank was checked */
+    unsigned long ulWatchUntil;  /* Time to stop watching unless it rises */
+    unsigned long ulNextCheck;   /* Time to read this tank next */
+    unsigned long long ullLastRead;  /* 1/3-second tick the floats read iLevel at */
+    BOOL fChecked;               /* TRUE once ullLastRead is valid */
+    int iLevel;                  /* Level last time this tank was checked */
+    int iNext;                   /* Next tank in the same slot or ready list */
+    BYTE byWhere;                /* OFLOW_IDLE, OFLOW_WHEEL, ... */
 } TANK_WATCH;
 
+typedef struct
+{
+    WORD wMsg;                   /* What happened */
+    int iValue;                  /* The tank or the level it happened to */
+    unsigned long long ullRead;  /* 1/3-second tick a level was read at */
+} OFLOW_MSG;
+
 /* Static Functions */
 static void vOverflowTask(void* pvParameters);
 static void vFloatCallback(int iFloatLevel);
+static void vOverflowSchedule(int iTank, unsigned long ulWhen);
+static void vOverflowExpire(void);
+static void vOverflowStartRead(void);
+static void vOverflowLevel(WORD wMsg, int iLevel, unsigned long long ullRead);
+static unsigned long ulOverflowCheckTime(int iTank, int iLevel, unsigned long long ullRead);
 
 /* Static Data */
 /* The stack and input queue for the Overflow task */
@@ -43,6 +89,38 @@ static void vFloatCallback(int iFloatLevel);
 #define Q_SIZE 10
 QueueHandle_t QOverflowTask;
 
+/* Tanks to add may fill all but this many places in the queue, so
+   that the tick and the float result, which must not wait, always
+   fit: there is never more than one of each in the queue. */
+#define Q_RESERVED 2
+static SemaphoreHandle_t semOflowRoom;
+
+/* Ticks not yet handled by the task, and whether a MSG_OFLOW_TIME is
+   in the queue for them */
+static unsigned long ulOflowTicksPending;
+static BOOL fOflowTimeQueued;
+
+/* Counters for the report */
+static OFLOW_STATS osStats;
+
+/* The watch state of every tank.  vOverflowBenchmark points a_tw
+   at a bigger array while it runs. */
+static TANK_WATCH a_twTanks[COUNTOF_TANKS];
+static TANK_WATCH* a_tw = a_twTanks;
+
+/* First tank in each slot of the wheel */
+static int a_iWheel[OFLOW_WHEEL_SLOTS];
+
+/* Tanks that are due for a check, oldest first */
+static int iReadyHead;
+static int iReadyTail;
+
+/* The tank whose float we're reading */
+static int iFloatTank;
+
+/* The time, in overflow ticks */
+static unsigned long ulOflowNow;
+
 
 /****** vOverflowSystemInit *********************************
 This routine initializes the Overflow system.
@@ -51,12 +129,30 @@ RETURNS: None.
 ***********************************************************/
 void vOverflowSystemInit(void)
 {
+    /* LOCAL VARIABLES */
+    int i;              /* The usual iterator */
+
+    /* We are watching no tanks */
+    for (i = 0; i < COUNTOF_TANKS; ++i)
+        a_tw[i].byWhere = OFLOW_IDLE;
+    for (i = 0; i < OFLOW_WHEEL_SLOTS; ++i)
+        a_iWheel[i] = NO_TANK;
+    iReadyHead = NO_TANK;
+    iReadyTail = NO_TANK;
+    iFloatTank = NO_TANK;
+    ulOflowNow = 0;
+    ulOflowTicksPending = 0;
+    fOflowTimeQueued = FALSE;
 
     /* Initialize the queue for this task. */
-    QOverflowTask = xQueueCreate(Q_SIZE, sizeof(WORD));
+    QOverflowTask = xQueueCreate(Q_SIZE, sizeof(OFLOW_MSG));
+    semOflowRoom = xSemaphoreCreateCounting(Q_SIZE - Q_RESERVED, Q_SIZE - Q_RESERVED);
 
     /* Start the task. */
     xTaskCreate(vOverflowTask, "ovrflw", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_OVERFLOW, NULL);
+
+    /* Check the watched tanks on every tick */
+    iTimerRegister(vOverflowTime, 1, TRUE);
 }
 
 /****** vOverflowTask ***************************************
@@ -67,100 +163,271 @@ RETURNS: None.
 static far void vOverflowTask(void* pvParameters)
 {
     /* LOCAL VARIABLES */
-    BYTE byErr;           /* Error code back from the OS */
-    WORD wMsg;           /* Message received from the queue */
-    TANK_WATCH tw[3];    /* Structure with which to watch tanks */
-    int i;              /* The usual iterator */
-    int iTank;          /* Tank number to watch */
-    int iFloatTank;     /* The tank whose float we're reading */
+    OFLOW_MSG om;        /* Message received from the queue */
+    TANK_WATCH* p_tw;    /* The tank the message is about */
+    unsigned long ulTicks;  /* Ticks to catch up on */
 
     /* Keep the compiler warnings away. */
     (void)pvParameters;
 
-    /* We are watching no tanks */
-    for (i = 0; i < 3; ++i)
-        tw[i].iTime = 0;
-    iFloatTank = 0;
-
     while (TRUE)
     {
         /* Wait for a message. */
-        xQueueReceive(QOverflowTask, &wMsg, portMAX_DELAY);
+        xQueueReceive(QOverflowTask, &om, portMAX_DELAY);
 
-        if (wMsg == MSG_OFLOW_TIME)
+        if (om.wMsg == MSG_OFLOW_TIME)
         {
-            if (iFloatTank == 0)
+            /* Take every tick so far. */
+            taskENTER_CRITICAL();
+            ulTicks = ulOflowTicksPending;
+            ulOflowTicksPending = 0;
+            fOflowTimeQueued = FALSE;
+            if (ulTicks > 1)
+                osStats.ulTicksLate += ulTicks - 1;
+            taskEXIT_CRITICAL();
+
+            /* Move the tanks that are due onto the ready list. */
+            for (; ulTicks > 0; --ulTicks)
             {
-                /* Find the first tank on the watch list. */
-                i = 0;
-                while (i < COUNTOF_TANKS && !iFloatTank)
-                {
-                    if (tw[i].iTime != 0)
-                    {
-                        /* This tank is on the watch list */
-                        /* Reduce the time for this tank. */
-                        --tw[i].iTime;
-
-                        /* Get the floats looking for the level
-                           in this tank. */
-                        iFloatTank = i;
-                        vReadFloats(iFloatTank + 1, vFloatCallback);
-                    }
-                    ++i;
-                }
+                ++ulOflowNow;
+                vOverflowExpire();
             }
         }
-        else if (wMsg >= MSG_OFLOW_ADD_TANK)
+        else if (om.wMsg == MSG_OFLOW_ADD_TANK)
         {
+            /* Its place in the queue is free for another. */
+            xSemaphoreGive(semOflowRoom);
+
             /* Add a tank to the watch list */
-            iTank = wMsg - MSG_OFLOW_ADD_TANK;
-            tw[iTank].iTime = OFLOW_WATCH_TIME;
-            iTankDataGet(iTank, &tw[iTank].iLevel, NULL, 1);
-        }
-        else /* wMsg must be a float level. */
-        {
-            /* If the tank is still rising... */
-            if (wMsg > tw[iFloatTank].iLevel)
+            p_tw = &a_tw[om.iValue];
+            p_tw->ulWatchUntil = ulOflowNow + OFLOW_WATCH_TIME;
+            if (p_tw->byWhere == OFLOW_IDLE)
             {
-                /* If the level is too high... */
-                if (wMsg >= OFLOW_THRESHOLD)
-                {
-                    /* Warn the user */
-                    vHardwareBellOn();
-                    vDisplayOverflow(iFloatTank);
-
-                    /* Stop watching this tank */
-                    tw[iFloatTank].iTime = 0;
-                }
-                else
-                {
-                    /* Keep watching it. */
-                    tw[iFloatTank].iTime = OFLOW_WATCH_TIME;
-                }
+                /* We know the level, but not when it was measured
+                   in our time, so check soon to learn the rate. */
+                iTankDataGet(om.iValue, &p_tw->iLevel, NULL, 1);
+                p_tw->fChecked = FALSE;
+                vOverflowSchedule(om.iValue, ulOflowNow + OFLOW_CHECK_MIN);
             }
+        }
+        else /* The floats have finished with iFloatTank. */
+            vOverflowLevel(om.wMsg, om.iValue, om.ullRead);
 
-            /* Store the new level */
-            tw[iFloatTank].iLevel = wMsg;
+        /* If the floats are free, read the next tank that is due. */
+        vOverflowStartRead();
+    }
+}
 
-            /* Find the first tank on the watch list. */
-            i = iFloatTank;
-            iFloatTank = 0;
-            while (i < COUNTOF_TANKS && !iFloatTank)
-            {
-                if (tw[i].iTime != 0)
-                {
-                    /* This tank is on the watch list */
-                    /* Reduce the time for this tank. */
-                    --tw[i].iTime;
-
-                    /* Get the floats looking for the level
-                       in this tank. */
-                    iFloatTank = i;
-                    vReadFloats(iFloatTank, vFloatCallback);
-                }
-                ++i;
-            }
+/****** vOverflowLevel *************************************
+This routine deals with the result of reading iFloatTank, from
+the floats or from the cache, and frees the floats for the next
+tank.
+
+RETURNS: None.
+***********************************************************/
+static void vOverflowLevel(
+    WORD wMsg,                /* MSG_OFLOW_LEVEL or MSG_OFLOW_FLOAT_FAILED */
+    int iLevel,               /* The level read */
+    unsigned long long ullRead)  /* The 1/3-second tick it was read at */
+{
+    /* LOCAL VARIABLES */
+    TANK_WATCH* p_tw;         /* The tank that was read */
+    unsigned long ulCheckTime;  /* Time until the next check */
+
+    p_tw = &a_tw[iFloatTank];
+    ulCheckTime = OFLOW_CHECK_MIN;
+
+    /* If the floats answered and the tank is still rising... */
+    if (wMsg == MSG_OFLOW_LEVEL && iLevel > p_tw->iLevel)
+    {
+        /* If the level is too high... */
+        if (iLevel >= iAlarmHighHighLevel(iFloatTank))
+        {
+            /* Warn the user */
+            vHardwareBellOn();
+            vDisplayOverflow(iFloatTank);
+
+            /* Stop watching this tank */
+            p_tw->ulWatchUntil = ulOflowNow;
         }
+        else
+        {
+            /* Keep watching it. */
+            p_tw->ulWatchUntil = ulOflowNow + OFLOW_WATCH_TIME;
+        }
+    }
+
+    /* Store the new level, working out when to look again */
+    if (wMsg == MSG_OFLOW_LEVEL)
+    {
+        ulCheckTime = ulOverflowCheckTime(iFloatTank, iLevel, ullRead);
+        p_tw->iLevel = iLevel;
+        p_tw->ullLastRead = ullRead;
+        p_tw->fChecked = TRUE;
+    }
+
+    /* Check it again later, unless we have watched long enough. */
+    if (ulOflowNow < p_tw->ulWatchUntil)
+        vOverflowSchedule(iFloatTank, ulOflowNow + ulCheckTime);
+    else
+        p_tw->byWhere = OFLOW_IDLE;
+    iFloatTank = NO_TANK;
+}
+
+/****** ulOverflowCheckTime *********************************
+This routine works out how long to wait before reading a tank
+again, from how fast it rose between the times the floats took
+the last reading and this one.  A failed
+read (or the first one), or a rise with no time between the
+readings, is looked at again as soon as possible.
+
+RETURNS: The time to wait, in 1/3 seconds.
+***********************************************************/
+static unsigned long ulOverflowCheckTime(
+    int iTank,                /* The tank, as of its last reading. */
+    int iLevel,               /* The level just read. */
+    unsigned long long ullRead)  /* The 1/3-second tick it was read at. */
+{
+    /* LOCAL VARIABLES */
+    TANK_WATCH* p_tw;         /* The watch state of the tank */
+    unsigned long ulElapsed;  /* Time between the two readings */
+    unsigned long ulWait;     /* Estimated time to the threshold */
+    int iRise;                /* Gallons risen since the last reading */
+    int iThreshold;           /* The level at which the tank overflows */
+
+    p_tw = &a_tw[iTank];
+    iThreshold = iAlarmHighHighLevel(iTank);
+
+    if (!p_tw->fChecked)
+        return(OFLOW_CHECK_MIN);
+
+    iRise = iLevel - p_tw->iLevel;
+    ulElapsed = (unsigned long)(ullRead - p_tw->ullLastRead);
+    if (iRise <= 0)
+        return(OFLOW_CHECK_MAX);
+
+    /* It rose with no time to measure a rate over; look again soon. */
+    if (ulElapsed == 0)
+        return(OFLOW_CHECK_MIN);
+    if (iLevel >= iThreshold)
+        return(OFLOW_CHECK_MIN);
+
+    /* At this rate, the threshold is (threshold - level) / rate away. */
+    ulWait = (unsigned long)(iThreshold - iLevel) * ulElapsed
+        / ((unsigned long)iRise * OFLOW_CHECK_DIVISOR);
+
+    if (ulWait < OFLOW_CHECK_MIN)
+        ulWait = OFLOW_CHECK_MIN;
+    if (ulWait > OFLOW_CHECK_MAX)
+        ulWait = OFLOW_CHECK_MAX;
+
+    return(ulWait);
+}
+
+/****** vOverflowSchedule ***********************************
+This routine puts a tank into the wheel slot for the time at
+which it should next be read.  A time more than a turn of the
+wheel away simply stays in its slot for extra turns.
+
+RETURNS: None.
+***********************************************************/
+static void vOverflowSchedule(
+    int iTank,                /* The tank to schedule. */
+    unsigned long ulWhen)     /* When to read it. */
+{
+    /* LOCAL VARIABLES */
+    int iSlot;                /* The slot for ulWhen */
+
+    iSlot = ulWhen & OFLOW_WHEEL_MASK;
+    a_tw[iTank].ulNextCheck = ulWhen;
+    a_tw[iTank].iNext = a_iWheel[iSlot];
+    a_tw[iTank].byWhere = OFLOW_WHEEL;
+    a_iWheel[iSlot] = iTank;
+}
+
+/****** vOverflowExpire *************************************
+This routine moves the tanks in the current wheel slot that are
+due onto the end of the ready list.  Only the current slot is
+looked at, so the work is the number of tanks due now plus any
+that are waiting out extra turns of the wheel.
+
+RETURNS: None.
+***********************************************************/
+static void vOverflowExpire(void)
+{
+    /* LOCAL VARIABLES */
+    int iSlot;          /* The slot for the current time */
+    int iTank;          /* Tank being looked at */
+    int iNext;          /* The tank after it in the slot */
+    int iKeep;          /* Tanks left in the slot for a later turn */
+
+    iSlot = ulOflowNow & OFLOW_WHEEL_MASK;
+    iTank = a_iWheel[iSlot];
+    iKeep = NO_TANK;
+
+    while (iTank != NO_TANK)
+    {
+        iNext = a_tw[iTank].iNext;
+        if (a_tw[iTank].ulNextCheck <= ulOflowNow)
+        {
+            /* This tank is due. Put it on the ready list. */
+            a_tw[iTank].iNext = NO_TANK;
+            a_tw[iTank].byWhere = OFLOW_READY;
+            if (iReadyTail == NO_TANK)
+                iReadyHead = iTank;
+            else
+                a_tw[iReadyTail].iNext = iTank;
+            iReadyTail = iTank;
+        }
+        else
+        {
+            /* Not this turn of the wheel. */
+            a_tw[iTank].iNext = iKeep;
+            iKeep = iTank;
+        }
+        iTank = iNext;
+    }
+
+    a_iWheel[iSlot] = iKeep;
+}
+
+/****** vOverflowStartRead **********************************
+This routine gets the floats reading the first tank on the
+ready list, if the floats are not already busy.  Tanks that the
+cache can answer are dealt with here and now, so the float
+callback never has to post to this task from this task.
+
+RETURNS: None.
+***********************************************************/
+static void vOverflowStartRead(void)
+{
+    /* LOCAL VARIABLES */
+    int iLevel;               /* Level found in the cache */
+    unsigned long long ullRead;   /* When the cache's level was read */
+    unsigned long long ullSince;  /* Oldest reading that will do */
+
+    while (iFloatTank == NO_TANK && iReadyHead != NO_TANK)
+    {
+        /* Take the tank off the ready list. */
+        iFloatTank = iReadyHead;
+        iReadyHead = a_tw[iFloatTank].iNext;
+        if (iReadyHead == NO_TANK)
+            iReadyTail = NO_TANK;
+        a_tw[iFloatTank].byWhere = OFLOW_READING;
+
+        /* Use a recent reading if there is one, or get the floats
+           looking for the level in this tank.  The reading must be
+           newer than the last one we used, or a rising tank would
+           look as if it had stopped. */
+        ullSince = ullTimeNowTicks();
+        ullSince = ullSince > OFLOW_MAX_READING_AGE ?
+            ullSince - OFLOW_MAX_READING_AGE : 0;
+        if (a_tw[iFloatTank].fChecked && a_tw[iFloatTank].ullLastRead >= ullSince)
+            ullSince = a_tw[iFloatTank].ullLastRead + 1;
+        if (fFloatCached(iFloatTank, ullSince, &iLevel, &ullRead))
+            vOverflowLevel(MSG_OFLOW_LEVEL, iLevel, ullRead);
+        else if (!fReadFloats(iFloatTank, vFloatCallback))
+            vOverflowLevel(MSG_OFLOW_FLOAT_FAILED, FLOAT_READ_FAILED, 0);
     }
 }
 
@@ -172,19 +439,69 @@ RETURNS: None.
 ***********************************************************/
 static void vFloatCallback(int iFloatLevelNew)
 {
-    
+    /* LOCAL VARIABLES */
+    OFLOW_MSG om;
+
     /* Put the level on the queue for the task. */
-    WORD msg = iFloatLevelNew;
-    xQueueSend(QOverflowTask, &msg, portMAX_DELAY);
+    om.wMsg = iFloatLevelNew == FLOAT_READ_FAILED ?
+        MSG_OFLOW_FLOAT_FAILED : MSG_OFLOW_LEVEL;
+    om.iValue = iFloatLevelNew;
+    om.ullRead = ullTimeNowTicks();
+
+    /* There is always room, since this is the only read the task
+       has going; never hold up the floats if that is wrong. */
+    if (xQueueSend(QOverflowTask, &om, 0) != pdTRUE)
+    {
+        taskENTER_CRITICAL();
+        ++osStats.ulPostsFailed;
+        taskEXIT_CRITICAL();
+    }
 }
 
 /****** vOverflowTime **************************************
-This routine is called three times a second.
+This routine is called three times a second, from the timer.
+It counts the tick and wakes the task, but never waits, so a
+busy task cannot hold up the clock: ticks the task has not got
+to yet are handled together.
 ***********************************************************/
 void vOverflowTime(void)
 {
-    WORD msg = MSG_OFLOW_TIME;
-    xQueueSend(QOverflowTask, &msg, portMAX_DELAY);
+    OFLOW_MSG om;
+    BOOL fPost;
+
+    taskENTER_CRITICAL();
+    ++osStats.ulTicks;
+    ++ulOflowTicksPending;
+    fPost = !fOflowTimeQueued;
+    fOflowTimeQueued = TRUE;
+    taskEXIT_CRITICAL();
+
+    /* One message covers every tick until the task takes it. */
+    if (!fPost)
+        return;
+
+    om.wMsg = MSG_OFLOW_TIME;
+    om.iValue = 0;
+    if (xQueueSend(QOverflowTask, &om, 0) != pdTRUE)
+    {
+        /* Try again on the next tick; this one is not lost. */
+        taskENTER_CRITICAL();
+        fOflowTimeQueued = FALSE;
+        ++osStats.ulPostsFailed;
+        taskEXIT_CRITICAL();
+    }
+}
+
+/****** vOverflowGetStats **********************************
+This routine returns the counters for the report.
+
+RETURNS: None.
+***********************************************************/
+void vOverflowGetStats(OFLOW_STATS* p_os)  /* Place to put them. */
+{
+    taskENTER_CRITICAL();
+    *p_os = osStats;
+    taskEXIT_CRITICAL();
 }
 
 /****** vOverflowAddTank ***********************************
@@ -192,9 +509,142 @@ This routine is called when a tank level is increasing.
 ***********************************************************/
 void vOverflowAddTank(int iTank)
 {
+    OFLOW_MSG om;
+
     /* Check that the parameter is valid. */
     assert(iTank >= 0 && iTank < COUNTOF_TANKS);
 
-    WORD msg = MSG_OFLOW_ADD_TANK + iTank;
-    xQueueSend(QOverflowTask, &msg, portMAX_DELAY);
-}
\ No newline at end of file
+    /* Wait for a place that leaves the reserved ones free. */
+    xSemaphoreTake(semOflowRoom, portMAX_DELAY);
+    om.wMsg = MSG_OFLOW_ADD_TANK;
+    om.iValue = iTank;
+    xQueueSend(QOverflowTask, &om, portMAX_DELAY);
+}
+
+/****** vOverflowBenchmark **********************************
+This routine runs the timer wheel for iWatched tanks, spread
+over iTanks, each read again after a pseudo-random time.  It
+checks that every tick finds exactly the tanks that a scan of
+every tank (the way this task used to work) finds.  The wheel's time and the scan's time
+are both reported.  It borrows the wheel, so it must run before
+the scheduler starts.
+
+RETURNS: None.
+***********************************************************/
+void vOverflowBenchmark(
+    int iTanks,               /* How many tanks there are. */
+    int iWatched,             /* How many of them to watch. */
+    SELF_TEST* p_st)          /* Place to put the results. */
+{
+    /* LOCAL VARIABLES */
+    TANK_WATCH* a_twSaved;    /* The real watch state */
+    int a_iWheelSaved[OFLOW_WHEEL_SLOTS];  /* The real wheel */
+    unsigned long ulNowSaved; /* The real time */
+    unsigned long ulRandom;   /* Pseudo-random check times */
+    unsigned long ulTick;     /* Ticks run */
+    unsigned long ulDueScan;  /* Tanks the scan found due */
+    unsigned long ulDueWheel; /* Tanks the wheel found due */
+    unsigned long long ullSumScan;   /* Tank numbers the scan found */
+    unsigned long long ullSumWheel;  /* Tank numbers the wheel found */
+    unsigned long long ullStart;     /* Time a pass started */
+    int iTank;                /* Iterator */
+    int iStride;              /* Tanks from one watched tank to the next */
+    int i;                    /* The usual iterator */
+
+    /* Check that the parameters are valid. */
+    assert(iTanks > 0);
+    assert(iWatched > 0 && iWatched <= iTanks);
+
+    p_st->ulCases = 0;
+    p_st->ulFailures = 0;
+    p_st->ullMicroseconds = 0;
+    p_st->ullBaseline = 0;
+
+    /* Put the real wheel aside; nothing is watched before the
+       scheduler starts, but leave it as it was found. */
+    assert(iReadyHead == NO_TANK && iFloatTank == NO_TANK);
+    a_twSaved = a_tw;
+    for (i = 0; i < OFLOW_WHEEL_SLOTS; ++i)
+    {
+        a_iWheelSaved[i] = a_iWheel[i];
+        a_iWheel[i] = NO_TANK;
+    }
+    ulNowSaved = ulOflowNow;
+    ulOflowNow = 0;
+
+    a_tw = malloc(iTanks * sizeof(TANK_WATCH));
+    if (a_tw == NULL)
+    {
+        ++p_st->ulFailures;
+        a_tw = a_twSaved;
+        return;
+    }
+
+    /* Mostly the real check times; every sixteenth watched tank
+       waits out more than a turn of the wheel. */
+    ulRandom = 1;
+    iStride = iTanks / iWatched;
+    for (iTank = 0; iTank < iTanks; ++iTank)
+    {
+        a_tw[iTank].byWhere = OFLOW_IDLE;
+        if (iTank % iStride != 0)
+            continue;
+        ulRandom = ulRandom * 1103515245UL + 12345UL;
+        vOverflowSchedule(iTank, OFLOW_CHECK_MIN + (iTank / iStride % 16 == 0 ?
+            2 * OFLOW_WHEEL_SLOTS : (ulRandom >> 16) % OFLOW_CHECK_MAX));
+    }
+
+    for (ulTick = 0; ulTick < OFLOW_BENCH_TICKS; ++ulTick)
+    {
+        ++ulOflowNow;
+
+        /* The old way: look at every tank. */
+        ullStart = ullStatsMicroseconds();
+        ulDueScan = 0;
+        ullSumScan = 0;
+        for (iTank = 0; iTank < iTanks; ++iTank)
+        {
+            if (a_tw[iTank].byWhere == OFLOW_WHEEL
+                && a_tw[iTank].ulNextCheck <= ulOflowNow)
+            {
+                ++ulDueScan;
+                ullSumScan += iTank;
+            }
+        }
+        p_st->ullBaseline += ullStatsMicroseconds() - ullStart;
+
+        /* The wheel: look at the current slot only. */
+        ullStart = ullStatsMicroseconds();
+        vOverflowExpire();
+        ulDueWheel = 0;
+        ullSumWheel = 0;
+        for (iTank = iReadyHead; iTank != NO_TANK; iTank = a_tw[iTank].iNext)
+        {
+            ++ulDueWheel;
+            ullSumWheel += iTank;
+        }
+        p_st->ullMicroseconds += ullStatsMicroseconds() - ullStart;
+
+        ++p_st->ulCases;
+        if (ulDueWheel != ulDueScan || ullSumWheel != ullSumScan)
+            ++p_st->ulFailures;
+
+        /* Read the due tanks and schedule their next checks. */
+        while (iReadyHead != NO_TANK)
+        {
+            iTank = iReadyHead;
+            iReadyHead = a_tw[iTank].iNext;
+            ulRandom = ulRandom * 1103515245UL + 12345UL;
+            vOverflowSchedule(iTank, ulOflowNow + OFLOW_CHECK_MIN
+                + (ulRandom >> 16) % OFLOW_CHECK_MAX);
+        }
+        iReadyTail = NO_TANK;
+    }
+
+    /* Put the real wheel back. */
+    free(a_tw);
+    a_tw = a_twSaved;
+    for (i = 0; i < OFLOW_WHEEL_SLOTS; ++i)
+        a_iWheel[i] = a_iWheelSaved[i];
+    ulOflowNow = ulNowSaved;
+}
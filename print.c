@@ -5,8 +5,8 @@ This module deals with the Tank Monitor printer.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include <string.h>
+#include "tankport.h"
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -17,28 +17,124 @@ This module deals with the Tank Monitor printer.
 #include "assert.h"
 
 /* Local Defines */
-#define MSG_PRINT_ALL        0x0020
-#define MSG_PRINT_TANK_HIST  0x0010
+/* Most jobs the spooler holds, waiting, printing or finished */
+#define PRINT_JOBS_MAX       16
+
+/* Lines are formatted only a few ahead of the printer, into a
+   ring.  The task is the only one to move iRingHead and the
+   interrupt the only one to move iRingTail. */
+#define PRINT_RING_LINES     8
+#define PRINT_LINE_LENGTH    21
+
+/* The parts of a report, in the order they are printed */
+#define REPORT_HEADER        0
+#define REPORT_BODY          1
+#define REPORT_RULE          2
+#define REPORT_BLANK         3
+#define REPORT_DONE          4
+
+/* Local Structures */
+/* A job in the spooler */
+typedef struct
+{
+    int iJob;                  /* The job's number, or PRINT_JOB_NONE */
+    BYTE byKind;               /* One of the PRINT_REPORT_ values */
+    BYTE byPriority;           /* PRINT_PRIORITY_ALARM or _NORMAL */
+    BYTE byAlarm;              /* ALARM_ bits, for an alarm report */
+    BYTE byState;              /* One of the PRINT_JOB_ states */
+    BOOL fCancel;              /* TRUE to stop it part way through */
+    int iTank;                 /* The tank a history or alarm report is about */
+    unsigned long long ullQueuedAt;   /* 1/3-second tick it was submitted at */
+    unsigned long long ullStartedAt;  /* When it reached the printer */
+    unsigned long long ullDoneAt;     /* When it finished or was cancelled */
+} PRINT_JOB;
+
+/* Where the report being printed has got to */
+typedef struct
+{
+    PRINT_JOB* p_pj;           /* The job being printed */
+    int iPart;                 /* One of the REPORT_ values */
+    int iTank;                 /* Next tank to list in an 'all' report */
+    int iLine;                 /* Next body line of an alarm report */
+    unsigned long ulEntry;     /* Next history entry to print */
+    unsigned long ulEnd;       /* History entry to stop at */
+    unsigned long ulGeneration;  /* Data generation when the report started */
+    BOOL fFromCache;           /* TRUE if no tank has changed since the
+                                  cached 'all' report was built */
+    int a_iTime[4];            /* When the report started */
+} REPORT;
 
 /* Static Functions */
 static void vPrinterTask(void* pvParameters);
+static PRINT_JOB* p_pjPrintNextJob(void);
+static int iPrintSubmit(BYTE byKind, BYTE byPriority, int iTank, BYTE byAlarm);
+static int iPrintStartBatch(void);
+static void vReportStart(PRINT_JOB* p_pj);
+static BOOL fReportNextLine(char* a_chLine);
+static void vReportTimeLine(char* a_chLine);
+static void vReportTankLine(int iTank, char* a_chLine);
 
 /* Static Data */
-/* The stack and input queue for the Printer task */
-#define Q_SIZE 10
-QueueHandle_t QPrinterTask;
+/* The lines of the reports */
+static const FORMAT_FIELD a_ffTime[] =
+{
+    FORMAT_TEXT("Time: "), FORMAT_INT_ZERO(2), FORMAT_TEXT(":"),
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTankLevel[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_TEXT(": "), FORMAT_INT,
+    FORMAT_TEXT(" gls."), FORMAT_END
+};
+static const FORMAT_FIELD a_ffTank[] =
+{
+    FORMAT_TEXT("Tank "), FORMAT_INT, FORMAT_END
+};
+static const FORMAT_FIELD a_ffAlarm[] =
+{
+    FORMAT_TEXT("ALARM Tank "), FORMAT_INT, FORMAT_END
+};
+static const FORMAT_FIELD a_ffHistory[] =
+{
+    FORMAT_INT_ZERO(2), FORMAT_TEXT(":"), FORMAT_INT_ZERO(2),
+    FORMAT_TEXT(":"), FORMAT_INT_ZERO(2), FORMAT_TEXT(" "),
+    FORMAT_INT_SPACE(4), FORMAT_TEXT(" gls."), FORMAT_END
+};
+
+/* The printer task, woken when a job is submitted */
+static TaskHandle_t xPrinterTask = NULL;
 
-/* Semaphore to wait for report to finish */
+/* Semaphore the interrupt gives each time a line finishes */
 SemaphoreHandle_t semPrinter;
 
-/* Place to construct report */
-static char a_chPrint[10][21];
+/* The spooler.  Everyone touches it with interrupts off. */
+static PRINT_JOB a_pj[PRINT_JOBS_MAX];
+static int iPrintLastJob;
+static PRINT_STATS psStats;
+
+/* The ring of lines formatted for the printer */
+static char aa_chRing[PRINT_RING_LINES][PRINT_LINE_LENGTH];
+static volatile int iRingHead;
+static volatile int iRingTail;
 
-/* Count of lines in report */
-static int iLinesTotal;
+/* Lines, from iRingTail on, that the printer has now, and the
+   list of them it was given */
+static volatile int iInPrinter;
+static PRINTER_LINE a_plBatch[PRINT_RING_LINES];
 
-/* Count of lines printed so far */
-static int iLinesPrinted;
+/* The report being printed */
+static REPORT rpt;
+
+/* The lines of the last 'all' report, with the time and the data
+   generation each was built from.  Lines are built again only if
+   what they show has changed. */
+static char a_chCacheTime[PRINT_LINE_LENGTH];
+static int a_iCacheTime[3] = { -1, -1, -1 };
+static char aa_chCacheTank[COUNTOF_TANKS][PRINT_LINE_LENGTH];
+static unsigned long a_ulCacheTank[COUNTOF_TANKS];
+static BOOL a_fCacheTank[COUNTOF_TANKS];
+static unsigned long ulCacheGeneration;
+static BOOL fCacheValid = FALSE;
 
 /****** vPrinterSystemInit **********************************
 This routine initializes the Printer system.
@@ -47,111 +143,427 @@ RETURNS: None.
 ***********************************************************/
 void vPrinterSystemInit(void)
 {
-    QPrinterTask = xQueueCreate(Q_SIZE, sizeof(WORD));
+    /* LOCAL VARIABLES */
+    int i;             /* The usual iterator */
 
-    xTaskCreate(vPrinterTask, "prnt", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_PRINTER, NULL);
+    for (i = 0; i < PRINT_JOBS_MAX; ++i)
+    {
+        a_pj[i].iJob = PRINT_JOB_NONE;
+        a_pj[i].byState = PRINT_JOB_DONE;
+    }
+
+    xTaskCreate(vPrinterTask, "prnt", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_PRINTER, &xPrinterTask);
 
     /* Initialize the semaphore as already taken */
     semPrinter = xSemaphoreCreateBinary();
 }
 
 /****** vPrinterTask ***************************************
-This routine is the task that handles the Printer.
+This routine is the task that handles the Printer.  It takes
+the most urgent job from the spooler and keeps the ring of
+lines topped up while the printer works through it, so that
+a report of any length needs only the ring.
 
 RETURNS: None.
 ***********************************************************/
 static void vPrinterTask(void* pvParameters)
 {
     /* LOCAL VARIABLES */
-    #define MAX_HISTORY 5
-    BYTE byErr;          /* Error code back from the OS */
-    WORD wMsg;          /* Message received from the queue */
-    int aa_iTime[MAX_HISTORY][4]; /* Time of day */
-    int iTank;          /* Tank iterator */
-    int a_iLevel[MAX_HISTORY]; /* Place to get level of tank */
-    int iLevels;       /* Number of history level entries */
-    int i;             /* The usual iterator */
+    PRINT_JOB* p_pj;    /* The job being printed */
+    BOOL fGenerated;    /* TRUE when every line has gone into the ring */
+    BOOL fFinished;     /* TRUE when every line has been printed */
+    int iCount;         /* Lines in the batch just started */
 
     /* Keep the compiler warnings away */
     (void)pvParameters;
 
     while (TRUE)
     {
-        /* Wait for a message */
-        xQueueReceive(QPrinterTask, &wMsg, portMAX_DELAY);
+        /* Wait for a job */
+        while ((p_pj = p_pjPrintNextJob()) == NULL)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-        //printf("func reached working");
-        //while (TRUE);
+        vReportStart(p_pj);
+        fGenerated = FALSE;
+        do
+        {
+            /* Format lines until the ring is full */
+            while (!fGenerated && iRingHead - iRingTail < PRINT_RING_LINES)
+            {
+                if (fReportNextLine(aa_chRing[iRingHead % PRINT_RING_LINES]))
+                    ++iRingHead;
+                else
+                    fGenerated = TRUE;
+            }
 
-        if (wMsg == MSG_PRINT_ALL)
+            /* Start the printer if it has run dry.  The batch is
+               handed over with interrupts on, since the printer may
+               take its time over it. */
+            taskENTER_CRITICAL();
+            iCount = iInPrinter == 0 ? iPrintStartBatch() : 0;
+            fFinished = fGenerated && iInPrinter == 0;
+            taskEXIT_CRITICAL();
+            if (iCount != 0)
+                vHardwarePrinterOutputBatch(a_plBatch, iCount);
+
+            /* Wait for a batch to finish */
+            if (!fFinished)
+                xSemaphoreTake(semPrinter, portMAX_DELAY);
+        } while (!fFinished);
+
+        taskENTER_CRITICAL();
+        p_pj->ullDoneAt = ullTimeNowTicks();
+        if (p_pj->fCancel)
         {
-            /* Format 'all' report */
-            iLinesTotal = 0;
-            vTimeGet(aa_iTime[0]);
-            sprintf(a_chPrint[iLinesTotal++],
-                "Time: %02d:%02d:%02d",
-                aa_iTime[0][0], aa_iTime[0][1], aa_iTime[0][2]);
+            p_pj->byState = PRINT_JOB_CANCELLED;
+            ++psStats.ulCancelled;
+        }
+        else
+        {
+            p_pj->byState = PRINT_JOB_DONE;
+            ++psStats.ulPrinted;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+/****** p_pjPrintNextJob ***********************************
+This routine takes the most urgent waiting job from the
+spooler: alarm reports first, then the oldest.
+
+RETURNS: The job, now printing, or NULL if none is waiting.
+***********************************************************/
+static PRINT_JOB* p_pjPrintNextJob(void)
+{
+    /* LOCAL VARIABLES */
+    PRINT_JOB* p_pjBest;   /* Most urgent job so far */
+    int i;                 /* The usual iterator */
+
+    p_pjBest = NULL;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < PRINT_JOBS_MAX; ++i)
+    {
+        if (a_pj[i].byState != PRINT_JOB_QUEUED)
+            continue;
+        if (p_pjBest == NULL ||
+            a_pj[i].byPriority < p_pjBest->byPriority ||
+            (a_pj[i].byPriority == p_pjBest->byPriority && a_pj[i].iJob < p_pjBest->iJob))
+            p_pjBest = &a_pj[i];
+    }
+
+    if (p_pjBest != NULL)
+    {
+        p_pjBest->byState = PRINT_JOB_PRINTING;
+        p_pjBest->ullStartedAt = ullTimeNowTicks();
+    }
+    taskEXIT_CRITICAL();
+
+    return(p_pjBest);
+}
+
+/****** iPrintSubmit ***************************************
+This routine puts a job in the spooler and returns at once.
+A request for a report that is already waiting to print gets
+that job rather than a second copy.
+
+RETURNS: The job number, or PRINT_JOB_NONE if the spooler
+is full of jobs that have not finished.
+***********************************************************/
+static int iPrintSubmit(
+    BYTE byKind,       /* One of the PRINT_REPORT_ values. */
+    BYTE byPriority,   /* PRINT_PRIORITY_ALARM or _NORMAL. */
+    int iTank,         /* The tank, for history and alarm reports. */
+    BYTE byAlarm)      /* The ALARM_ bits, for alarm reports. */
+{
+    /* LOCAL VARIABLES */
+    PRINT_JOB* p_pjFree;   /* Slot to put the job in */
+    int iJob;              /* The job number to return */
+    int i;                 /* The usual iterator */
+
+    p_pjFree = NULL;
+    iJob = PRINT_JOB_NONE;
 
-            for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    taskENTER_CRITICAL();
+    ++psStats.ulSubmitted;
+    for (i = 0; i < PRINT_JOBS_MAX && iJob == PRINT_JOB_NONE; ++i)
+    {
+        if (a_pj[i].byState == PRINT_JOB_QUEUED)
+        {
+            /* Is this the same report? */
+            if (a_pj[i].byKind == byKind && a_pj[i].iTank == iTank &&
+                a_pj[i].byAlarm == byAlarm)
             {
-                //printf("%d %d", iTank, COUNTOF_TANKS);
-                if (iTankDataGet(iTank, a_iLevel, NULL, 1) == 1)
-                {
-                    /* We have data for this tank; display it */
-                    sprintf(a_chPrint[iLinesTotal++],
-                        "Tank %d: %d gls.", iTank + 1, a_iLevel[0]);
-                }
-                else {
-                    sprintf(a_chPrint[iLinesTotal++],
-                        "No Data");
-                }
+                iJob = a_pj[i].iJob;
+                ++psStats.ulDuplicates;
+            }
+        }
+        else if (a_pj[i].byState != PRINT_JOB_PRINTING)
+        {
+            /* Finished; reuse the one that finished longest ago */
+            if (p_pjFree == NULL || a_pj[i].iJob < p_pjFree->iJob)
+                p_pjFree = &a_pj[i];
+        }
+    }
+
+    if (iJob == PRINT_JOB_NONE)
+    {
+        if (p_pjFree != NULL)
+        {
+            iJob = ++iPrintLastJob;
+            p_pjFree->iJob = iJob;
+            p_pjFree->byKind = byKind;
+            p_pjFree->byPriority = byPriority;
+            p_pjFree->byAlarm = byAlarm;
+            p_pjFree->iTank = iTank;
+            p_pjFree->fCancel = FALSE;
+            p_pjFree->byState = PRINT_JOB_QUEUED;
+            p_pjFree->ullQueuedAt = ullTimeNowTicks();
+        }
+        else
+        {
+            ++psStats.ulRejected;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (iJob != PRINT_JOB_NONE && xPrinterTask != NULL)
+        xTaskNotifyGive(xPrinterTask);
+
+    return(iJob);
+}
+
+/****** vReportStart ***************************************
+This routine gets ready to produce the lines of a report.
+
+RETURNS: None.
+***********************************************************/
+static void vReportStart(PRINT_JOB* p_pj)  /* The job to print. */
+{
+    rpt.p_pj = p_pj;
+    rpt.iPart = REPORT_HEADER;
+    rpt.iTank = 0;
+    rpt.iLine = 0;
+    vTimeGet(rpt.a_iTime);
+
+    if (p_pj->byKind == PRINT_REPORT_ALL)
+    {
+        /* If nothing has been added since the cached report was
+           built, every tank line can come straight from it */
+        rpt.ulGeneration = ulTankDataGeneration();
+        rpt.fFromCache = fCacheValid && rpt.ulGeneration == ulCacheGeneration;
+    }
+    else if (p_pj->byKind == PRINT_REPORT_HISTORY)
+    {
+        /* Print whatever history the tank has now, oldest first */
+        rpt.ulEnd = ulTankDataCount(p_pj->iTank);
+        rpt.ulEntry = rpt.ulEnd > HISTORY_DEPTH ? rpt.ulEnd - HISTORY_DEPTH : 0;
+    }
+}
+
+/****** fReportNextLine ************************************
+This routine formats the next line of the report.  A job
+cancelled part way through skips to the end of the report.
+
+RETURNS: TRUE if there was another line, FALSE at the end.
+***********************************************************/
+static BOOL fReportNextLine(char* a_chLine)  /* Place to put the line. */
+{
+    /* LOCAL VARIABLES */
+    int a_iArgs[4];    /* Numbers for the line */
+    int iLevel;        /* A level from the history */
+    PRINT_JOB* p_pj;   /* The job being printed */
+
+    p_pj = rpt.p_pj;
+    if (p_pj->fCancel && rpt.iPart < REPORT_RULE)
+        rpt.iPart = REPORT_RULE;
+
+    switch (rpt.iPart)
+    {
+    case REPORT_HEADER:
+        rpt.iPart = REPORT_BODY;
+        a_iArgs[0] = p_pj->iTank + 1;
+        if (p_pj->byKind == PRINT_REPORT_ALL)
+            vReportTimeLine(a_chLine);
+        else if (p_pj->byKind == PRINT_REPORT_ALARM)
+            iFormat(a_chLine, a_ffAlarm, a_iArgs);
+        else
+            iFormat(a_chLine, a_ffTank, a_iArgs);
+        return(TRUE);
+
+    case REPORT_BODY:
+        if (p_pj->byKind == PRINT_REPORT_ALL)
+        {
+            if (rpt.iTank < COUNTOF_TANKS)
+            {
+                vReportTankLine(rpt.iTank, a_chLine);
+                ++rpt.iTank;
+                return(TRUE);
+            }
+
+            /* Every tank line is now as of the start of the report */
+            ulCacheGeneration = rpt.ulGeneration;
+            fCacheValid = TRUE;
+        }
+        else if (p_pj->byKind == PRINT_REPORT_ALARM)
+        {
+            /* Say what is wrong, then when */
+            if (rpt.iLine == 0)
+            {
+                strcpy(a_chLine, (p_pj->byAlarm & ALARM_HIGH_HIGH) ?
+                    "OVERFLOWING" : "LEAKING");
+                ++rpt.iLine;
+                return(TRUE);
+            }
+            if (rpt.iLine == 1)
+            {
+                iFormat(a_chLine, a_ffTime, rpt.a_iTime);
+                ++rpt.iLine;
+                return(TRUE);
             }
-            sprintf(a_chPrint[iLinesTotal++], "----------------");
-            sprintf(a_chPrint[iLinesTotal++], " ");
         }
         else
         {
-            /* Print the history of a single tank */
-            iLinesTotal = 0;
-            iTank = wMsg - MSG_PRINT_TANK_HIST;
-            iLevels = iTankDataGet(iTank, a_iLevel, (int*)aa_iTime, MAX_HISTORY);
-            sprintf(a_chPrint[iLinesTotal++], "Tank %d", iTank + 1);
-            for (i = iLevels - 1; i >= 0; --i)
+            /* Skip any entries overwritten since the report started */
+            while (rpt.ulEntry < rpt.ulEnd)
             {
-                sprintf(a_chPrint[iLinesTotal++],
-                    "%02d:%02d:%02d %4d gls.",
-                    aa_iTime[i][0], aa_iTime[i][1], aa_iTime[i][2], a_iLevel[i]);
+                if (fTankDataGetEntry(p_pj->iTank, rpt.ulEntry++, &iLevel, a_iArgs))
+                {
+                    a_iArgs[3] = iLevel;
+                    iFormat(a_chLine, a_ffHistory, a_iArgs);
+                    return(TRUE);
+                }
             }
-            sprintf(a_chPrint[iLinesTotal++], "----------------");
-            sprintf(a_chPrint[iLinesTotal++], " ");
         }
+        rpt.iPart = REPORT_RULE;
+        /* Fall through to the end of the report */
 
-        iLinesPrinted = 0;
-        vHardwarePrinterOutputLine(a_chPrint[iLinesPrinted++]);
+    case REPORT_RULE:
+        rpt.iPart = REPORT_BLANK;
+        strcpy(a_chLine, "----------------");
+        return(TRUE);
 
-        /* Wait for print job to finish */
-        //OSSemPend(semPrinter, WAIT_FOREVER, &byErr);
-        xSemaphoreTake(semPrinter,portMAX_DELAY);
+    case REPORT_BLANK:
+        rpt.iPart = REPORT_DONE;
+        strcpy(a_chLine, " ");
+        return(TRUE);
     }
+
+    return(FALSE);
 }
 
-/****** vPrinterInterrupt **********************************
-This routine is called when the printer interrupts.
+/****** vReportTimeLine ***********************************
+This routine gets the time line of an 'all' report, building
+it only if the time is not the one in the cache.
 
 RETURNS: None.
 ***********************************************************/
-void vPrinterInterrupt(void)
+static void vReportTimeLine(char* a_chLine)  /* Place to put the line. */
 {
-    if (iLinesPrinted == iLinesTotal)
+    if (rpt.a_iTime[0] != a_iCacheTime[0] || rpt.a_iTime[1] != a_iCacheTime[1] ||
+        rpt.a_iTime[2] != a_iCacheTime[2])
     {
-        /* The report is done. Release the semaphore */
-        xSemaphoreGive(semPrinter);
+        iFormat(a_chCacheTime, a_ffTime, rpt.a_iTime);
+        a_iCacheTime[0] = rpt.a_iTime[0];
+        a_iCacheTime[1] = rpt.a_iTime[1];
+        a_iCacheTime[2] = rpt.a_iTime[2];
+        ++psStats.ulLinesFormatted;
     }
     else
     {
-        /* Print the next line */
-        vHardwarePrinterOutputLine(a_chPrint[iLinesPrinted++]);
+        ++psStats.ulLinesCached;
+    }
+
+    strcpy(a_chLine, a_chCacheTime);
+}
+
+/****** vReportTankLine ***********************************
+This routine gets the line of an 'all' report for one tank,
+building it only if the tank has a reading that the cached
+line does not show.
+
+RETURNS: None.
+***********************************************************/
+static void vReportTankLine(
+    int iTank,         /* The tank. */
+    char* a_chLine)    /* Place to put the line. */
+{
+    /* LOCAL VARIABLES */
+    unsigned long ulCount;     /* Readings ever taken for the tank */
+    int a_iArgs[2];            /* Numbers for the line */
+
+    if (!rpt.fFromCache)
+    {
+        /* Get the count before the level, so that the cached line is
+           never newer than the count says */
+        ulCount = ulTankDataCount(iTank);
+        if (!a_fCacheTank[iTank] || ulCount != a_ulCacheTank[iTank])
+        {
+            if (iTankDataGet(iTank, &a_iArgs[1], NULL, 1) == 1)
+            {
+                /* We have data for this tank; print it */
+                a_iArgs[0] = iTank + 1;
+                iFormat(aa_chCacheTank[iTank], a_ffTankLevel, a_iArgs);
+            }
+            else
+            {
+                strcpy(aa_chCacheTank[iTank], "No Data");
+            }
+            a_ulCacheTank[iTank] = ulCount;
+            a_fCacheTank[iTank] = TRUE;
+            ++psStats.ulLinesFormatted;
+            strcpy(a_chLine, aa_chCacheTank[iTank]);
+            return;
+        }
     }
+
+    ++psStats.ulLinesCached;
+    strcpy(a_chLine, aa_chCacheTank[iTank]);
+}
+
+/****** iPrintStartBatch **********************************
+This routine puts every formatted line the printer has room
+for into a batch, and counts them as in the printer.  Call it
+with the printer idle and interrupts off, and hand the batch to
+the printer once interrupts are back on.
+
+RETURNS: The number of lines in the batch.
+***********************************************************/
+static int iPrintStartBatch(void)
+{
+    /* LOCAL VARIABLES */
+    int iCount;        /* Lines in the batch */
+    int i;             /* The usual iterator */
+
+    iCount = iRingHead - iRingTail;
+    if (iCount > iHardwarePrinterBufferLines())
+        iCount = iHardwarePrinterBufferLines();
+
+    for (i = 0; i < iCount; ++i)
+        a_plBatch[i].p_chLine = aa_chRing[(iRingTail + i) % PRINT_RING_LINES];
+
+    iInPrinter = iCount;
+    return(iCount);
+}
+
+/****** vPrinterInterrupt **********************************
+This routine is called when the printer interrupts, having
+finished a batch.  It frees the batch's lines and wakes the task,
+which starts the next batch and formats more.
+
+RETURNS: None.
+***********************************************************/
+void vPrinterInterrupt(void)
+{
+    /* The printer task looks at the ring with interrupts off. */
+    taskENTER_CRITICAL();
+
+    /* The finished lines' places in the ring are free again */
+    iRingTail += iInPrinter;
+    iInPrinter = 0;
+    taskEXIT_CRITICAL();
+
+    xSemaphoreGive(semPrinter);
 }
 
 /****** vPrintAll *****************************************
@@ -159,9 +571,7 @@ This routine is called when a printout is needed.
 ***********************************************************/
 void vPrintAll(void)
 {
-
-    WORD msg = MSG_PRINT_ALL;
-    xQueueSend(QPrinterTask, &msg, portMAX_DELAY);
+    iPrintSubmit(PRINT_REPORT_ALL, PRINT_PRIORITY_NORMAL, NO_TANK, 0);
 }
 
 /****** vPrintTankHistory **********************************
@@ -172,6 +582,134 @@ void vPrintTankHistory(int iTank)
     /* Check that the parameter is valid */
     assert(iTank >= 0 && iTank < COUNTOF_TANKS);
 
-    WORD msg = MSG_PRINT_TANK_HIST + iTank;
-    xQueueSend(QPrinterTask, &msg, portMAX_DELAY);
-}
\ No newline at end of file
+    iPrintSubmit(PRINT_REPORT_HISTORY, PRINT_PRIORITY_NORMAL, iTank, 0);
+}
+
+/****** iPrintAlarm ****************************************
+This routine is called when a tank starts overflowing or
+leaking.  The report goes ahead of any others waiting.
+
+RETURNS: The job number, or PRINT_JOB_NONE if the spooler
+is full.
+***********************************************************/
+int iPrintAlarm(
+    int iTank,         /* The tank. */
+    BYTE byAlarm)      /* ALARM_HIGH_HIGH or ALARM_LEAK. */
+{
+    /* Check that the parameters are valid */
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+    assert(byAlarm == ALARM_HIGH_HIGH || byAlarm == ALARM_LEAK);
+
+    return(iPrintSubmit(PRINT_REPORT_ALARM, PRINT_PRIORITY_ALARM, iTank, byAlarm));
+}
+
+/****** fPrintJobCancel ************************************
+This routine cancels a job.  A waiting job never prints; one
+that is printing stops after the lines already formatted.
+
+RETURNS: TRUE if the job was waiting or printing.
+***********************************************************/
+BOOL fPrintJobCancel(int iJob)  /* The job number. */
+{
+    /* LOCAL VARIABLES */
+    PRINT_JOB* p_pj;   /* The job's slot */
+    BOOL fReturn;      /* What to return */
+    int i;             /* The usual iterator */
+
+    fReturn = FALSE;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < PRINT_JOBS_MAX; ++i)
+    {
+        p_pj = &a_pj[i];
+        if (p_pj->iJob != iJob)
+            continue;
+
+        if (p_pj->byState == PRINT_JOB_QUEUED)
+        {
+            p_pj->byState = PRINT_JOB_CANCELLED;
+            p_pj->ullStartedAt = p_pj->ullDoneAt = ullTimeNowTicks();
+            ++psStats.ulCancelled;
+            fReturn = TRUE;
+        }
+        else if (p_pj->byState == PRINT_JOB_PRINTING)
+        {
+            /* The printer task notes the cancellation when it ends */
+            p_pj->fCancel = TRUE;
+            fReturn = TRUE;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return(fReturn);
+}
+
+/****** fPrintJobStatus ************************************
+This routine finds out how a job is getting on.
+
+RETURNS: TRUE, or FALSE if the spooler no longer has the job.
+***********************************************************/
+BOOL fPrintJobStatus(
+    int iJob,                  /* The job number. */
+    PRINT_JOB_STATUS* p_pjs)   /* Place to put the status. */
+{
+    /* LOCAL VARIABLES */
+    PRINT_JOB* p_pj;   /* The job's slot */
+    unsigned long long ullNow;   /* The time now */
+    BOOL fReturn;      /* What to return */
+    int i;             /* The usual iterator */
+
+    fReturn = FALSE;
+
+    taskENTER_CRITICAL();
+    ullNow = ullTimeNowTicks();
+    for (i = 0; i < PRINT_JOBS_MAX; ++i)
+    {
+        p_pj = &a_pj[i];
+        if (p_pj->iJob != iJob)
+            continue;
+
+        p_pjs->byState = p_pj->byState;
+        if (p_pj->byState == PRINT_JOB_QUEUED)
+        {
+            p_pjs->ulQueued = (unsigned long)(ullNow - p_pj->ullQueuedAt);
+            p_pjs->ulPrinting = 0;
+        }
+        else if (p_pj->byState == PRINT_JOB_PRINTING)
+        {
+            p_pjs->ulQueued = (unsigned long)(p_pj->ullStartedAt - p_pj->ullQueuedAt);
+            p_pjs->ulPrinting = (unsigned long)(ullNow - p_pj->ullStartedAt);
+        }
+        else
+        {
+            p_pjs->ulQueued = (unsigned long)(p_pj->ullStartedAt - p_pj->ullQueuedAt);
+            p_pjs->ulPrinting = (unsigned long)(p_pj->ullDoneAt - p_pj->ullStartedAt);
+        }
+        fReturn = TRUE;
+    }
+    taskEXIT_CRITICAL();
+
+    return(fReturn);
+}
+
+/****** iPrintLastJobNumber ********************************
+This routine finds the number of the latest job submitted.
+
+RETURNS: The job number, or 0 if none has been.
+***********************************************************/
+int iPrintLastJobNumber(void)
+{
+    return(iPrintLastJob);
+}
+
+/****** vPrintGetStats *************************************
+This routine copies the spooler's counters.
+
+RETURNS: None.
+***********************************************************/
+void vPrintGetStats(PRINT_STATS* p_ps)  /* Place to put them. */
+{
+    taskENTER_CRITICAL();
+    *p_ps = psStats;
+    taskEXIT_CRITICAL();
+}
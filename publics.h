@@ -11,8 +11,12 @@ for the modules.
 #define WAIT_FOREVER  0
 
 /* The priorities of the various tasks */
+#define TASK_PRIORITY_SIM          1
+#define TASK_PRIORITY_DEBUG_RENDER 2
 #define TASK_PRIORITY_DEBUG_TIMER  6
 #define TASK_PRIORITY_DEBUG_ADD    7
+#define TASK_PRIORITY_DEBUG_LOAD  12
+#define TASK_PRIORITY_DEBUG_INJECT 19
 #define TASK_PRIORITY_BUTTON      10
 #define TASK_PRIORITY_DISPLAY     11
 #define TASK_PRIORITY_OVERFLOW    13
@@ -20,14 +24,162 @@ for the modules.
 #define TASK_PRIORITY_LEVELS      20
 
 #define COUNTOF_TANKS  3
+
+/* The timer ticks this many times a second */
+#define TIMER_TICKS_PER_SECOND  3
 #define NO_TANK       -1
 
+
+/* The level passed to a float callback when the floats never answered */
+#define FLOAT_READ_FAILED  -1
+
+/* Bits in the alarm mask that vAlarmScan produces for each tank */
+#define ALARM_HIGH_HIGH  0x01   /* Overflowing */
+#define ALARM_HIGH       0x02   /* Nearly full */
+#define ALARM_LOW        0x04   /* Nearly empty */
+#define ALARM_LEAK       0x08   /* Falling steadily */
+
+/* Number of readings data.c keeps for each tank */
+#define HISTORY_DEPTH  8
+
+/* The level iTankDataGetLatest gives for a tank with no readings yet */
+#define TANK_NO_LEVEL  -1
+
+/* Print jobs */
+#define PRINT_JOB_NONE         -1   /* No job number */
+#define PRINT_REPORT_ALL        0   /* Levels of every tank */
+#define PRINT_REPORT_HISTORY    1   /* History of one tank */
+#define PRINT_REPORT_ALARM      2   /* A tank overflowing or leaking */
+#define PRINT_PRIORITY_ALARM    0   /* Printed first */
+#define PRINT_PRIORITY_NORMAL   1
+#define PRINT_JOB_QUEUED        0   /* Waiting for the printer */
+#define PRINT_JOB_PRINTING      1
+#define PRINT_JOB_DONE          2
+#define PRINT_JOB_CANCELLED     3
+
+/* Number of buckets in a latency histogram */
+#define STATS_HIST_BUCKETS  24
+
+/* Kinds of field in a format template */
+#define FMT_END        0   /* End of the template */
+#define FMT_TEXT       1   /* Fixed text */
+#define FMT_INT        2   /* A number, as "%d" */
+#define FMT_INT_ZERO   3   /* A number padded with zeros, as "%0*d" */
+#define FMT_INT_SPACE  4   /* A number padded with spaces, as "%*d" */
+
+/* Fields for building format templates */
+#define FORMAT_TEXT(s)         { FMT_TEXT, 0, (s) }
+#define FORMAT_INT             { FMT_INT, 0, NULL }
+#define FORMAT_INT_ZERO(w)     { FMT_INT_ZERO, (w), NULL }
+#define FORMAT_INT_SPACE(w)    { FMT_INT_SPACE, (w), NULL }
+#define FORMAT_END             { FMT_END, 0, NULL }
+
+/* The number iTimerRegister gives when it has no room */
+#define TIMER_NONE  -1
+
+/* The time scale for running the simulated time as fast as it can go */
+#define TIMER_SCALE_MAX  0
+
 /* Structures */
 typedef void (*V_FLOAT_CALLBACK) (int iFloatLevel);
+typedef void (*V_TIMER_CALLBACK) (void);
+
+typedef struct
+{
+    BYTE byKind;               /* One of the FMT_ values */
+    BYTE byWidth;              /* Minimum width of a padded number */
+    const char* p_chText;      /* The text of a FMT_TEXT field */
+} FORMAT_FIELD;
+
+typedef struct
+{
+    unsigned long ulRequests;       /* Looks in the cache */
+    unsigned long ulCacheHits;      /* Requests answered from the cache */
+    unsigned long ulHardwareReads;  /* Requests that went to the floats */
+} FLOAT_STATS;
+
+typedef struct
+{
+    unsigned long ulTicks;          /* Ticks from the timer */
+    unsigned long ulTicksLate;      /* Ticks the task caught up on late */
+    unsigned long ulPostsFailed;    /* Messages the queue had no room for */
+} OFLOW_STATS;
+
+typedef struct
+{
+    unsigned long ulNotifications;     /* Changes posted to the display task */
+    unsigned long ulWakeups;           /* Times the display task woke for them */
+    unsigned long ulRenders;           /* Lines the display task produced */
+    unsigned long ulWritesSuppressed;  /* Renders identical to the display */
+    unsigned long ulWritesIssued;      /* Writes made to the display */
+    unsigned long ulCellsWritten;      /* Characters sent to the display */
+} DISPLAY_STATS;
+
+typedef struct
+{
+    unsigned long ulReads;      /* Readings that came back from the floats */
+    unsigned long ulP50;        /* Median latency, in 1/3 seconds */
+    unsigned long ulP99;        /* 99th percentile latency, in 1/3 seconds */
+    unsigned long ulMax;        /* Worst latency, in 1/3 seconds */
+    unsigned long ulTimeouts;   /* Attempts that missed their deadline */
+    unsigned long ulStuck;      /* Reads abandoned after every retry */
+} FLOAT_LATENCY;
+
+typedef struct
+{
+    unsigned long a_ulBucket[STATS_HIST_BUCKETS];  /* Samples in each bucket */
+    unsigned long ulCount;      /* Total number of samples */
+    unsigned long ulMax;        /* Largest sample */
+} STATS_HIST;
+
+typedef struct
+{
+    char* p_chLine;            /* A line for the printer */
+} PRINTER_LINE;
+
+typedef struct
+{
+    BYTE byState;              /* One of the PRINT_JOB_ states */
+    unsigned long ulQueued;    /* 1/3 seconds spent waiting for the printer */
+    unsigned long ulPrinting;  /* 1/3 seconds spent printing */
+} PRINT_JOB_STATUS;
+
+typedef struct
+{
+    unsigned long ulSubmitted;    /* Reports asked for */
+    unsigned long ulDuplicates;   /* Asked for while the same one was waiting */
+    unsigned long ulRejected;     /* Turned away with the spooler full */
+    unsigned long ulPrinted;      /* Printed to the end */
+    unsigned long ulCancelled;    /* Cancelled before the end */
+    unsigned long ulLinesFormatted;  /* Report lines built from the data */
+    unsigned long ulLinesCached;  /* Report lines reused unchanged */
+} PRINT_STATS;
+
+typedef struct
+{
+    unsigned long ulKeys;         /* Keys handed to the simulation */
+    unsigned long ulInterrupts;   /* Keyboard interrupts that ran */
+    unsigned long ulCoalesced;    /* Keys handled by an interrupt raised for
+                                     an earlier key */
+    unsigned long ulFullWaits;    /* Times the input thread found the ring
+                                     full and had to wait */
+    unsigned long ulDropped;      /* Keys lost because the ring stayed full */
+} KEY_STATS;
+
+typedef struct
+{
+    unsigned long ulCases;        /* Results checked */
+    unsigned long ulFailures;     /* Results that came out wrong */
+    unsigned long long ullMicroseconds;  /* Time the code under test took */
+    unsigned long long ullBaseline;      /* Time the old way took the same
+                                            work */
+} SELF_TEST;
 
 /* Public functions in main.c */
 void vEmbeddedMain(void);
 /* The main routine of the hardware-independent software */
+void vKeyboardGetStats(KEY_STATS* p_ks);
+/* Returns the counts of keys passed in from the keyboard */
 
 /* Public functions in display.c */
 void vDisplaySystemInit(void);
@@ -41,6 +193,12 @@ void vDisplayTankLevel(int iTank);
 void vDisplayTime(void);
 /* Tells the display software that the user has requested
    to view the time */
+void vDisplayNextPage(void);
+/* Tells the display software that the user has requested
+   to view the next page of tank levels */
+void vDisplayPrevPage(void);
+/* Tells the display software that the user has requested
+   to view the previous page of tank levels */
 void vDisplayPrompt(int iPrompt);
 /* Tells the display software that the command software
    wants to display a prompt */
@@ -51,8 +209,14 @@ void vDisplayLeak(int iTank);
 /* Tells the display software that a leak has been detected */
 void vDisplayOverflow(int iTank);
 /* Tells the display software that an overflow has been detected */
-void vDisplayResetAlarm(void);
+void vDisplayLow(int iTank);
+/* Tells the display software that a tank is nearly empty */
+#define DISP_ALARM_CURRENT   0   /* The alarm on the display */
+#define DISP_ALARM_ALL       1   /* Every alarm */
+void vDisplayResetAlarm(int iWhich);
 /* Tells the display software that the user has pressed the reset button */
+void vDisplayGetStats(DISPLAY_STATS* p_ds);
+/* Returns the counts of display writes made and suppressed */
 
 /* Public functions in button.c */
 void vButtonSystemInit(void);
@@ -60,6 +224,9 @@ void vButtonSystemInit(void);
 void vButtonInterrupt(void);
 /* Called by the shell software to indicate that the user/tester
    has pressed a button */
+void vButtonSelfTest(SELF_TEST* p_st);
+/* Checks the command table against the switch it replaced, for every
+   state and key */
 
 char* p_chGetCommandPrompt(int iPrompt);
 /* Called by the display software to find the text of the prompt
@@ -79,24 +246,46 @@ void vPrintAll(void);
 /* Called when the user requests to print the report that shows the levels in all tanks */
 void vPrintTankHistory(int iTank);
 /* Called when the user requests to print the history of levels in one tank */
+int iPrintAlarm(int iTank, BYTE byAlarm);
+/* Called when a tank starts overflowing or leaking, to print an alarm
+   report ahead of anything else waiting */
+BOOL fPrintJobCancel(int iJob);
+/* Cancels a print job that is waiting or printing */
+BOOL fPrintJobStatus(int iJob, PRINT_JOB_STATUS* p_pjs);
+/* Returns the state of a print job and how long it waited and printed */
+int iPrintLastJobNumber(void);
+/* Returns the number of the latest print job */
+void vPrintGetStats(PRINT_STATS* p_ps);
+/* Returns the print spooler counters */
 
 /* Hardware-dependent functions (currently in dbgmanc.c) */
 void vHardwareInit(void);
 /* Initializes various things in the shell software */
+void vSimulationKeyboardInterruptHandler(int xKeyPressed);
+/* Handles one key from the keyboard, in the keyboard interrupt */
+void vSimulationButtonPress(WORD wButton);
+/* Presses one of the (simulated) buttons */
 void vHardwareDisplayLine(char* a_chDisp);
 /* Displays a string of characters on the (simulated) display */
-WORD vHardwareButtonFetch(void);
+void vHardwareDisplayChars(int iColumn, char* a_chChars, int iCount);
+/* Replaces iCount characters of the (simulated) display, starting at iColumn */
+WORD wHardwareButtonFetch(void);
 /* Returns the identity of the (simulated) button that the user/tester has pressed */
 void vHardwareFloatSetup(int iTankNumber);
 /* Tells the (simulated) floats to look for the level in one of the tanks */
+void vHardwareFloatCancel(void);
+/* Tells the (simulated) floats to stop looking */
 int iHardwareFloatGetData(void);
 /* Returns the value that is read by the (simulated) floats */
 void vHardwareBellOn(void);
 /* Turns on the (simulated) bell */
 void vHardwareBellOff(void);
 /* Turns off the (simulated) bell */
-void vHardwarePrinterOutputLine(char* a_chPrint);
-/* Prints a string of characters on the (simulated) printer */
+void vHardwarePrinterOutputBatch(const PRINTER_LINE* a_pl, int iCount);
+/* Prints a batch of lines on the (simulated) printer, which interrupts
+   once when it has printed them all */
+int iHardwarePrinterBufferLines(void);
+/* Returns the most lines the (simulated) printer takes in one batch */
 
 /* Public functions in timer.c */
 void vTimerInit(void);
@@ -105,6 +294,17 @@ void vTimerOneThirdSecond(void);
 /* Called by the shell software to indicate that 1/3 of a second has elapsed */
 void vTimeGet(int* a_iTime);
 /* Returns the current time (since the system started operating) */
+unsigned long long ullTimeNowTicks(void);
+/* Returns the number of 1/3-second ticks since the system started */
+int iTimerRegister(V_TIMER_CALLBACK vCallback, unsigned long ulTicks, BOOL fPeriodic);
+/* Arranges for a routine to be called after some 1/3-second ticks,
+   and again every so many ticks if it is periodic */
+void vTimerCancel(int iTimer);
+/* Stops a routine registered with iTimerRegister from being called */
+void vTimerScaleSet(int iScale);
+int iTimerScale(void);
+/* Sets and returns how many times faster than real time the simulated
+   hardware runs, or TIMER_SCALE_MAX */
 
 /* Public functions in data.c */
 void vTankDataInit(void);
@@ -113,16 +313,82 @@ void vTankDataAdd(int iTank, int iLevel);
 /* Adds a new item to the database */
 int iTankDataGet(int iTank, int* a_iLevels, int* a_iTimes, int iLimit);
 /* Retrieves one or more items from the database */
+int iTankDataGetTicks(int iTank, unsigned long long* a_ullTicks, int iLimit);
+/* Retrieves when the latest items were added, in 1/3-second ticks */
+int iTankDataGetLatest(int iFirst, int iCount, int* a_iLevels);
+/* Retrieves the latest level of each of a run of tanks at once */
+unsigned long ulTankDataCount(int iTank);
+/* Returns the number of items ever added for a tank */
+unsigned long ulTankDataGeneration(void);
+/* Returns the number of items ever added for all tanks together */
+BOOL fTankDataGetEntry(int iTank, unsigned long ulEntry, int* p_iLevel, int* a_iTime);
+/* Retrieves one item, by number, from the history of a tank */
 
 /* Public functions in floats.c */
 void vFloatInit(void);
 /* Initializes the float-reading software */
-void vReadFloats(int iTankNumber, V_FLOAT_CALLBACK vCb);
+BOOL fFloatCached(int iTankNumber, unsigned long long ullSince, int* p_iLevel,
+    unsigned long long* p_ullTick);
+/* Gets the last reading of a tank, if it is no older than xMaxAge ticks */
+BOOL fReadFloats(int iTankNumber, V_FLOAT_CALLBACK vCb);
 /* Sets up the hardware (with a call to the hardware-dependent software
-   or to the shell software) to read a level from the floats */
+   or to the shell software) to read a level from the floats, and later
+   calls vCb with it.  If the floats never answer, vCb is called with
+   FLOAT_READ_FAILED.  Returns FALSE, without calling vCb, if the floats
+   are wedged */
+void vFloatGetStats(FLOAT_STATS* p_fs);
+/* Returns the float cache hit and hardware read counters */
+void vFloatGetLatency(int iTank, FLOAT_LATENCY* p_fl);
+/* Returns the read latency percentiles and failure counts for one tank */
 void vFloatInterrupt(void);
 /* Called by the shell software to indicate that the floats have been read */
 
+/* Public functions in alarms.c */
+void vAlarmSystemInit(void);
+/* Loads the alarm thresholds for every tank */
+int iAlarmHighHighLevel(int iTank);
+/* Returns the level at which a tank is overflowing */
+void vAlarmLevelSet(int iTank, int iLevel, int iLeakRate);
+/* Records the latest level of a tank and how fast (gallons per hour) it
+   is steadily falling */
+void vAlarmScan(BYTE* a_byAlarms);
+/* Checks every threshold of every tank, giving one byte of ALARM_ bits
+   per tank */
+void vAlarmBenchmark(int iTanks, SELF_TEST* p_st);
+/* Times the scan of iTanks made-up tanks against checking them one at
+   a time */
+
+/* Public functions in stats.c */
+void vStatsHistInit(STATS_HIST* p_sh);
+/* Empties a latency histogram */
+void vStatsHistAdd(STATS_HIST* p_sh, unsigned long ulSample);
+/* Adds a sample to a latency histogram */
+unsigned long ulStatsHistPercentile(const STATS_HIST* p_sh, int iPercent);
+/* Returns (an upper bound on) a percentile of the samples in a histogram */
+unsigned long long ullStatsMicroseconds(void);
+/* Returns the time from the high-resolution clock, in microseconds */
+void vStatsCriticalEntered(void);
+void vStatsCriticalLeaving(void);
+/* Called with interrupts off as each critical section starts and ends */
+void vStatsGetCritical(STATS_HIST* p_sh);
+/* Returns how long critical sections held off interrupts, in microseconds */
+
+/* Every critical section in the system is timed.  This file always
+   comes after task.h, so these take the place of the kernel's own. */
+#undef taskENTER_CRITICAL
+#undef taskEXIT_CRITICAL
+#define taskENTER_CRITICAL() \
+    do { portENTER_CRITICAL(); vStatsCriticalEntered(); } while (0)
+#define taskEXIT_CRITICAL() \
+    do { vStatsCriticalLeaving(); portEXIT_CRITICAL(); } while (0)
+
+/* Public functions in format.c */
+int iFormat(char* a_chOut, const FORMAT_FIELD* a_ff, const int* a_iArgs);
+/* Builds a line from a format template and its numbers, returning
+   its length */
+void vFormatSelfTest(SELF_TEST* p_st);
+/* Checks iFormat against sprintf, and times the two */
+
 /* Public functions in overflow.c */
 void vOverflowSystemInit(void);
 /* Initializes the overflow-detection software */
@@ -131,5 +397,26 @@ void vOverflowTime(void);
 void vOverflowAddTank(int iTank);
 /* Called by the level-tracking software to indicate that
    the overflow-detection software should track this tank */
+void vOverflowGetStats(OFLOW_STATS* p_os);
+/* Returns the overflow task's counters */
+void vOverflowBenchmark(int iTanks, int iWatched, SELF_TEST* p_st);
+/* Runs the timer wheel for iWatched of iTanks tanks against a scan of
+   every tank; call before the scheduler starts */
+
+/* Public functions in sim.c */
+void vSimInit(unsigned long ulSeed, unsigned long ulSeconds, const char* p_chTrace);
+/* Starts a repeatable run of the simulated hardware from a seed,
+   writing what the hardware does to a trace file */
+BOOL fSimRunning(void);
+/* Returns TRUE if the simulation is driving the hardware shell */
+void vSimFloatsStarted(int iTank);
+void vSimFloatsCancelled(void);
+/* Called by the hardware shell when the floats start and stop looking */
+int iSimTankLevel(int iTank);
+/* Returns the level the (simulated) floats find in a tank */
+void vSimPrinterStarted(int iLines, int iLinesPerSecond);
+/* Called by the hardware shell when the printer is given a batch */
+void vSimTrace(const char* p_chWhat, int iColumn, const char* p_chText, int iCount);
+/* Writes something the hardware did to the trace */
 
 #endif
@@ -0,0 +1,460 @@
+/****************************************************
+                          SIM.C
+This module drives the simulated hardware from a
+seeded list of events on a virtual clock, instead of
+from the keyboard and the Windows clock, so that a run
+can be repeated exactly and as fast as the machine
+can go.  Everything the hardware does is written to a
+trace file.
+****************************************************/
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "tankport.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "publics.h"
+#include "assert.h"
+
+/* Local Defines */
+/* Most events that can be waiting at once */
+#define SIM_EVENTS_MAX       16
+
+/* Kinds of event */
+#define SIM_EVT_TICK         0   /* 1/3 of a second has gone by */
+#define SIM_EVT_FLOW         1   /* The tanks fill and drain a little */
+#define SIM_EVT_FLOATS       2   /* The floats have found a level */
+#define SIM_EVT_PRINTER      3   /* The printer has finished a batch */
+#define SIM_EVT_BUTTON       4   /* Somebody presses a button */
+#define SIM_EVT_END          5   /* The run is over */
+
+/* Virtual time is kept in microseconds */
+#define SIM_SECOND           1000000ULL
+
+/* How the tanks behave.  Each second every tank changes by its
+   flow; every so often each tank gets a new flow. */
+#define SIM_FLOW_EVERY       600        /* Seconds between new flows */
+#define SIM_FLOW_MIN         -3         /* Gallons per second */
+#define SIM_FLOW_MAX         4
+#define SIM_LEVEL_MAX        8000       /* Gallons */
+
+/* The floats take this long to answer... */
+#define SIM_FLOAT_MIN_MS     50
+#define SIM_FLOAT_RANGE_MS   100
+
+/* ...and somebody presses a button this often. */
+#define SIM_BUTTON_MIN_S     5
+#define SIM_BUTTON_RANGE_S   55
+
+/* Local Structures */
+typedef struct
+{
+    unsigned long long ullAt;  /* Virtual time it happens */
+    unsigned long ulSeq;       /* Order it was scheduled in, to break ties */
+    BYTE byKind;               /* SIM_EVT_ */
+    unsigned long ulValue;     /* Depends on the kind */
+} SIM_EVENT;
+
+/* Static Functions */
+static void vSimTask(void* pvParameters);
+static void vSimSchedule(unsigned long long ullAt, BYTE byKind, unsigned long ulValue);
+static void vSimNextEvent(SIM_EVENT* p_se);
+static BOOL fSimEarlier(const SIM_EVENT* p_se1, const SIM_EVENT* p_se2);
+static void vSimFlow(void);
+static void vSimFinish(void);
+static unsigned long ulSimRandom(void);
+
+/* Static Data */
+/* The events waiting to happen, as a heap with the earliest on top */
+static SIM_EVENT a_se[SIM_EVENTS_MAX];
+static int iSimEvents = 0;
+static unsigned long ulSimSeq = 0;
+
+/* The virtual clock, and when the run ends */
+static unsigned long long ullSimNow = 0;
+static unsigned long long ullSimEnd;
+
+/* The state of the random numbers */
+static unsigned long ulSimRandomState;
+
+/* TRUE once vSimInit has been called */
+static BOOL fSim = FALSE;
+
+/* The level and flow of each tank */
+static int a_iSimLevel[COUNTOF_TANKS];
+static int a_iSimFlow[COUNTOF_TANKS];
+
+/* Changes each time the floats start or stop, so that an answer to
+   a read that has since been cancelled is thrown away */
+static unsigned long ulSimFloatsRead = 0;
+
+/* Ticks made so far, and seconds of flow */
+static unsigned long long ullSimTicks = 0;
+static unsigned long ulSimFlows = 0;
+
+/* The trace, events handled, and when the run started in real time */
+static FILE* p_fileSimTrace;
+static unsigned long ulSimDispatched = 0;
+static LARGE_INTEGER liSimStart;
+
+/* The buttons that get pressed */
+static const char a_chSimButtons[] = "123TGPAHR";
+
+/****** vSimInit ********************************************
+This routine sets up a run of the simulation and starts the
+task that drives it.  Call it before the scheduler starts,
+after the rest of the system has been initialized.
+
+RETURNS: None.
+***********************************************************/
+void vSimInit(
+    unsigned long ulSeed,      /* The same seed gives the same run. */
+    unsigned long ulSeconds,   /* How much virtual time to simulate. */
+    const char* p_chTrace)     /* File to write the trace to. */
+{
+    /* LOCAL VARIABLES */
+    int iTank;         /* Tank iterator */
+
+    p_fileSimTrace = fopen(p_chTrace, "w");
+    assert(p_fileSimTrace != NULL);
+
+    /* The random numbers must not start at 0, or they stay there. */
+    ulSimRandomState = ulSeed != 0 ? ulSeed : 0x9E3779B9UL;
+
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        a_iSimLevel[iTank] = (int)(ulSimRandom() % SIM_LEVEL_MAX);
+        a_iSimFlow[iTank] = 0;
+    }
+
+    /* Nothing should spend real time standing in for time passing. */
+    vTimerScaleSet(TIMER_SCALE_MAX);
+
+    ullSimEnd = (unsigned long long)ulSeconds * SIM_SECOND;
+    vSimSchedule(SIM_SECOND / TIMER_TICKS_PER_SECOND, SIM_EVT_TICK, 0);
+    vSimSchedule(0, SIM_EVT_FLOW, 0);
+    vSimSchedule((SIM_BUTTON_MIN_S + ulSimRandom() % SIM_BUTTON_RANGE_S) * SIM_SECOND,
+        SIM_EVT_BUTTON, 0);
+    vSimSchedule(ullSimEnd, SIM_EVT_END, 0);
+
+    fprintf(p_fileSimTrace, "SEED %lu SECONDS %lu\n", ulSeed, ulSeconds);
+    fSim = TRUE;
+
+    xTaskCreate(vSimTask, "sim", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_SIM, NULL);
+}
+
+/****** fSimRunning *****************************************
+This routine tells the hardware shell whether the simulation,
+rather than the keyboard and the clock, is driving it.
+
+RETURNS: TRUE if the simulation is running.
+***********************************************************/
+BOOL fSimRunning(void)
+{
+    return(fSim);
+}
+
+/****** vSimTask ********************************************
+This routine is the task that hands out the events in order of
+virtual time.  It runs below every task of the system, so it
+only moves on to the next event when the system has finished
+with the last one; that, and the seed, make the run the same
+every time.
+
+RETURNS: None.
+***********************************************************/
+static void vSimTask(void* pvParameters)
+{
+    /* LOCAL VARIABLES */
+    SIM_EVENT se;      /* The event to handle */
+    unsigned long long ullAt;  /* When the next one of its kind happens */
+
+    /* Prevent the compiler warning about the unused parameter. */
+    (void)pvParameters;
+
+    QueryPerformanceCounter(&liSimStart);
+
+    while (TRUE)
+    {
+        vSimNextEvent(&se);
+        ullSimNow = se.ullAt;
+        ++ulSimDispatched;
+
+        switch (se.byKind)
+        {
+        case SIM_EVT_TICK:
+            /* Work out each tick from the start, so that thirds of
+               a second do not add up to an error. */
+            ++ullSimTicks;
+            vSimSchedule((ullSimTicks + 1) * SIM_SECOND / TIMER_TICKS_PER_SECOND,
+                SIM_EVT_TICK, 0);
+            vTimerOneThirdSecond();
+            break;
+
+        case SIM_EVT_FLOW:
+            vSimFlow();
+            vSimSchedule(ullSimNow + SIM_SECOND, SIM_EVT_FLOW, 0);
+            break;
+
+        case SIM_EVT_FLOATS:
+            if (se.ulValue == ulSimFloatsRead)
+                vFloatInterrupt();
+            break;
+
+        case SIM_EVT_PRINTER:
+            vPrinterInterrupt();
+            break;
+
+        case SIM_EVT_BUTTON:
+            vSimTrace("BUTTON", 0, &a_chSimButtons[se.ulValue], 1);
+            vSimulationButtonPress((WORD)a_chSimButtons[se.ulValue]);
+
+            /* Draw the time before the button, so the two numbers
+               come out of the generator in the same order everywhere */
+            ullAt = ullSimNow +
+                (SIM_BUTTON_MIN_S + ulSimRandom() % SIM_BUTTON_RANGE_S) * SIM_SECOND;
+            vSimSchedule(ullAt, SIM_EVT_BUTTON,
+                ulSimRandom() % (sizeof(a_chSimButtons) - 1));
+            break;
+
+        case SIM_EVT_END:
+            vSimFinish();
+            break;
+        }
+
+        /* Let anything the event woke run before the next one. */
+        taskYIELD();
+    }
+}
+
+/****** vSimFloatsStarted ***********************************
+This routine is called by the hardware shell when the system
+asks the floats about a tank.  They answer a little later.
+
+RETURNS: None.
+***********************************************************/
+void vSimFloatsStarted(int iTank)   /* The tank. */
+{
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    taskENTER_CRITICAL();
+    ++ulSimFloatsRead;
+    vSimSchedule(ullSimNow +
+        (SIM_FLOAT_MIN_MS + ulSimRandom() % SIM_FLOAT_RANGE_MS) * (SIM_SECOND / 1000),
+        SIM_EVT_FLOATS, ulSimFloatsRead);
+    taskEXIT_CRITICAL();
+}
+
+/****** vSimFloatsCancelled *********************************
+This routine is called by the hardware shell when the system
+tells the floats to stop looking.
+
+RETURNS: None.
+***********************************************************/
+void vSimFloatsCancelled(void)
+{
+    taskENTER_CRITICAL();
+    ++ulSimFloatsRead;
+    taskEXIT_CRITICAL();
+}
+
+/****** iSimTankLevel ***************************************
+This routine gives the level the floats find in a tank.
+
+RETURNS: The level, in gallons.
+***********************************************************/
+int iSimTankLevel(int iTank)   /* The tank. */
+{
+    assert(iTank >= 0 && iTank < COUNTOF_TANKS);
+
+    return(a_iSimLevel[iTank]);
+}
+
+/****** vSimPrinterStarted **********************************
+This routine is called by the hardware shell when the printer
+is given a batch of lines.  It interrupts once it has printed
+them all.
+
+RETURNS: None.
+***********************************************************/
+void vSimPrinterStarted(
+    int iLines,                /* Lines in the batch. */
+    int iLinesPerSecond)       /* How fast the printer goes. */
+{
+    assert(iLines > 0 && iLinesPerSecond > 0);
+
+    vSimSchedule(ullSimNow + iLines * SIM_SECOND / iLinesPerSecond,
+        SIM_EVT_PRINTER, 0);
+}
+
+/****** vSimTrace *******************************************
+This routine writes one thing the hardware did to the trace,
+stamped with the virtual time.
+
+RETURNS: None.
+***********************************************************/
+void vSimTrace(
+    const char* p_chWhat,      /* The piece of hardware. */
+    int iColumn,               /* Where on it, if that matters. */
+    const char* p_chText,      /* What it showed or printed. */
+    int iCount)                /* How many characters of it. */
+{
+    fprintf(p_fileSimTrace, "%llu.%06llu %-7s %2d |%.*s|\n",
+        ullSimNow / SIM_SECOND, ullSimNow % SIM_SECOND,
+        p_chWhat, iColumn, iCount, p_chText);
+}
+
+/****** vSimFlow ********************************************
+This routine moves each tank on by one second of its flow, and
+now and then gives the tanks new flows.
+
+RETURNS: None.
+***********************************************************/
+static void vSimFlow(void)
+{
+    /* LOCAL VARIABLES */
+    int iTank;         /* Tank iterator */
+
+    for (iTank = 0; iTank < COUNTOF_TANKS; ++iTank)
+    {
+        if (ulSimFlows % SIM_FLOW_EVERY == 0)
+            a_iSimFlow[iTank] = SIM_FLOW_MIN +
+                (int)(ulSimRandom() % (SIM_FLOW_MAX - SIM_FLOW_MIN + 1));
+
+        a_iSimLevel[iTank] += a_iSimFlow[iTank];
+        if (a_iSimLevel[iTank] < 0)
+            a_iSimLevel[iTank] = 0;
+        if (a_iSimLevel[iTank] > SIM_LEVEL_MAX)
+            a_iSimLevel[iTank] = SIM_LEVEL_MAX;
+    }
+    ++ulSimFlows;
+}
+
+/****** vSimFinish ******************************************
+This routine ends the run, closing the trace and saying how
+much faster than real time it went.
+
+RETURNS: Does not return.
+***********************************************************/
+static void vSimFinish(void)
+{
+    /* LOCAL VARIABLES */
+    LARGE_INTEGER liNow;       /* Real time now */
+    LARGE_INTEGER liFrequency; /* Counts per second of real time */
+    unsigned long long ullReal;    /* Real time the run took, in us */
+
+    QueryPerformanceCounter(&liNow);
+    QueryPerformanceFrequency(&liFrequency);
+    ullReal = (unsigned long long)(liNow.QuadPart - liSimStart.QuadPart) *
+        1000000ULL / liFrequency.QuadPart;
+
+    fprintf(p_fileSimTrace, "END %lu events\n", ulSimDispatched);
+    fclose(p_fileSimTrace);
+
+    printf("\nSimulation: %llu s of virtual time, %lu events, in %llu ms (%llux)\n",
+        ullSimNow / SIM_SECOND, ulSimDispatched, ullReal / 1000,
+        ullReal != 0 ? ullSimNow / ullReal : 0);
+    exit(0);
+}
+
+/****** vSimSchedule ****************************************
+This routine adds an event to the heap.
+
+RETURNS: None.
+***********************************************************/
+static void vSimSchedule(
+    unsigned long long ullAt,  /* Virtual time it happens. */
+    BYTE byKind,               /* SIM_EVT_ */
+    unsigned long ulValue)     /* Depends on the kind. */
+{
+    /* LOCAL VARIABLES */
+    SIM_EVENT se;      /* The new event */
+    int i;             /* Where it goes */
+
+    se.ullAt = ullAt;
+    se.byKind = byKind;
+    se.ulValue = ulValue;
+
+    taskENTER_CRITICAL();
+    assert(iSimEvents < SIM_EVENTS_MAX);
+    se.ulSeq = ulSimSeq++;
+
+    /* Move it up past every parent that is later. */
+    for (i = iSimEvents++; i > 0 && fSimEarlier(&se, &a_se[(i - 1) / 2]); i = (i - 1) / 2)
+        a_se[i] = a_se[(i - 1) / 2];
+    a_se[i] = se;
+    taskEXIT_CRITICAL();
+}
+
+/****** vSimNextEvent ***************************************
+This routine takes the earliest event off the heap.  There is
+always one, since the ticks go on for ever.
+
+RETURNS: None.
+***********************************************************/
+static void vSimNextEvent(SIM_EVENT* p_se)   /* Place to put it. */
+{
+    /* LOCAL VARIABLES */
+    SIM_EVENT seLast;  /* The event moved down from the end */
+    int i;             /* Where it might go */
+    int iChild;        /* The earlier child of i */
+
+    taskENTER_CRITICAL();
+    assert(iSimEvents > 0);
+
+    *p_se = a_se[0];
+    seLast = a_se[--iSimEvents];
+
+    /* Move the last event down from the top past every child that
+       is earlier. */
+    for (i = 0; (iChild = 2 * i + 1) < iSimEvents; i = iChild)
+    {
+        if (iChild + 1 < iSimEvents && fSimEarlier(&a_se[iChild + 1], &a_se[iChild]))
+            ++iChild;
+        if (!fSimEarlier(&a_se[iChild], &seLast))
+            break;
+        a_se[i] = a_se[iChild];
+    }
+    a_se[i] = seLast;
+    taskEXIT_CRITICAL();
+}
+
+/****** fSimEarlier *****************************************
+This routine orders two events.  Events at the same time go in
+the order they were scheduled.
+
+RETURNS: TRUE if the first comes before the second.
+***********************************************************/
+static BOOL fSimEarlier(
+    const SIM_EVENT* p_se1,
+    const SIM_EVENT* p_se2)
+{
+    if (p_se1->ullAt != p_se2->ullAt)
+        return(p_se1->ullAt < p_se2->ullAt);
+    return(p_se1->ulSeq < p_se2->ulSeq);
+}
+
+/****** ulSimRandom *****************************************
+This routine gives the next number from a xorshift generator,
+which gives the same numbers from the same seed everywhere.
+
+RETURNS: The number.
+***********************************************************/
+static unsigned long ulSimRandom(void)
+{
+    /* LOCAL VARIABLES */
+    unsigned long ul;  /* The number */
+
+    /* Keep it to 32 bits, where unsigned long is wider */
+    taskENTER_CRITICAL();
+    ulSimRandomState ^= (ulSimRandomState << 13) & 0xFFFFFFFFUL;
+    ulSimRandomState ^= ulSimRandomState >> 17;
+    ulSimRandomState ^= (ulSimRandomState << 5) & 0xFFFFFFFFUL;
+    ul = ulSimRandomState;
+    taskEXIT_CRITICAL();
+
+    return(ul);
+}
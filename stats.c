@@ -0,0 +1,172 @@
+/****************************************************
+                          STATS.C
+This module keeps latency histograms for the other
+modules.
+****************************************************/
+
+/* Standard includes. */
+#include <stdio.h>
+#include "tankport.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "publics.h"
+#include "assert.h"
+
+/* Static Data */
+/* How long critical sections held off interrupts, in microseconds,
+   when the outermost one now running began, and how deep they are
+   nested.  Only touched with interrupts off. */
+static STATS_HIST shCritical;
+static unsigned long long ullCriticalSince;
+static int iCriticalNesting = 0;
+
+/****** vStatsHistInit **************************************
+This routine empties a histogram.
+
+RETURNS: None.
+***********************************************************/
+void vStatsHistInit(STATS_HIST* p_sh)   /* The histogram to empty. */
+{
+    /* LOCAL VARIABLES */
+    int i;             /* The usual iterator */
+
+    for (i = 0; i < STATS_HIST_BUCKETS; ++i)
+        p_sh->a_ulBucket[i] = 0;
+    p_sh->ulCount = 0;
+    p_sh->ulMax = 0;
+}
+
+/****** vStatsHistAdd ***************************************
+This routine adds one sample to a histogram.  Bucket 0 counts
+samples of 0; bucket n counts samples from 2^(n-1) to 2^n - 1;
+the last bucket also counts everything larger.
+
+RETURNS: None.
+***********************************************************/
+void vStatsHistAdd(
+    STATS_HIST* p_sh,           /* The histogram to add to. */
+    unsigned long ulSample)     /* The sample. */
+{
+    /* LOCAL VARIABLES */
+    int iBucket;       /* Bucket for this sample */
+    unsigned long ul;  /* Sample, shifted down to find the bucket */
+
+    iBucket = 0;
+    for (ul = ulSample; ul != 0 && iBucket < STATS_HIST_BUCKETS - 1; ul >>= 1)
+        ++iBucket;
+
+    ++p_sh->a_ulBucket[iBucket];
+    ++p_sh->ulCount;
+    if (ulSample > p_sh->ulMax)
+        p_sh->ulMax = ulSample;
+}
+
+/****** ulStatsHistPercentile *******************************
+This routine finds a percentile of the samples in a histogram.
+The answer is the top of the bucket holding that sample, so it
+is never below the true value and never more than twice it.
+
+RETURNS: The percentile, or 0 if the histogram is empty.
+***********************************************************/
+unsigned long ulStatsHistPercentile(
+    const STATS_HIST* p_sh,     /* The histogram. */
+    int iPercent)               /* Which percentile (0 to 100). */
+{
+    /* LOCAL VARIABLES */
+    unsigned long ulRank;      /* Number of samples at or below the answer */
+    unsigned long ulSeen;      /* Samples counted so far */
+    unsigned long ulTop;       /* Largest value in the current bucket */
+    int i;                     /* The usual iterator */
+
+    assert(iPercent >= 0 && iPercent <= 100);
+
+    if (p_sh->ulCount == 0)
+        return(0);
+
+    /* Round the rank up, so that p99 of 10 samples is the 10th. */
+    ulRank = (p_sh->ulCount * iPercent + 99) / 100;
+    if (ulRank == 0)
+        ulRank = 1;
+
+    ulSeen = 0;
+    ulTop = 0;
+    for (i = 0; i < STATS_HIST_BUCKETS; ++i)
+    {
+        if (i == 0)
+            ulTop = 0;
+        else if (i == STATS_HIST_BUCKETS - 1)
+            ulTop = p_sh->ulMax;
+        else
+            ulTop = (1UL << i) - 1;
+        ulSeen += p_sh->a_ulBucket[i];
+        if (ulSeen >= ulRank)
+            break;
+    }
+
+    /* The true value cannot be above the largest sample. */
+    if (ulTop > p_sh->ulMax)
+        ulTop = p_sh->ulMax;
+
+    return(ulTop);
+}
+
+/****** ullStatsMicroseconds ********************************
+This routine reads the high-resolution clock.
+
+RETURNS: The time, in microseconds from some fixed start.
+***********************************************************/
+unsigned long long ullStatsMicroseconds(void)
+{
+    /* LOCAL VARIABLES */
+    LARGE_INTEGER liNow;        /* The clock */
+    LARGE_INTEGER liFrequency;  /* Clock ticks a second */
+
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liNow);
+    /* Whole seconds first, so that a clock counting nanoseconds since
+       boot does not overflow. */
+    return((unsigned long long)(liNow.QuadPart / liFrequency.QuadPart) * 1000000ULL
+        + (unsigned long long)(liNow.QuadPart % liFrequency.QuadPart) * 1000000ULL
+        / liFrequency.QuadPart);
+}
+
+/****** vStatsCriticalEntered *******************************
+This routine notes when the outermost critical section began.
+Call it with interrupts off.
+
+RETURNS: None.
+***********************************************************/
+void vStatsCriticalEntered(void)
+{
+    if (iCriticalNesting++ == 0)
+        ullCriticalSince = ullStatsMicroseconds();
+}
+
+/****** vStatsCriticalLeaving *******************************
+This routine notes how long interrupts were off, as the
+outermost critical section ends.  Call it with interrupts still
+off.
+
+RETURNS: None.
+***********************************************************/
+void vStatsCriticalLeaving(void)
+{
+    if (--iCriticalNesting == 0)
+        vStatsHistAdd(&shCritical,
+            (unsigned long)(ullStatsMicroseconds() - ullCriticalSince));
+}
+
+/****** vStatsGetCritical ***********************************
+This routine returns how long critical sections have held off
+interrupts.
+
+RETURNS: None.
+***********************************************************/
+void vStatsGetCritical(STATS_HIST* p_sh)   /* Place to put the figures. */
+{
+    taskENTER_CRITICAL();
+    *p_sh = shCritical;
+    taskEXIT_CRITICAL();
+}
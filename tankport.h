@@ -0,0 +1,103 @@
+/*********************************************************
+                         TANKPORT.H
+This include file hides the differences between the
+Windows build and the POSIX build.  On Windows it pulls
+in the Windows headers; elsewhere it supplies the few
+Windows types and calls that the modules use.
+*********************************************************/
+
+#ifndef _TANKPORT
+#define _TANKPORT
+
+#if defined(_WIN32)
+
+#include <conio.h>
+#include <Windows.h>
+
+#else
+
+/* What the modules get from Windows.h on Windows */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef long long LONGLONG;
+
+#define TRUE   1
+#define FALSE  0
+
+/* Left over from 16-bit compilers; means nothing now */
+#define far
+
+typedef union
+{
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+/* The interlocked operations, with the same results as on Windows:
+   the Increment and CompareExchange calls return the new and the
+   old value, and all of them are full barriers. */
+static inline LONG InterlockedExchange(volatile LONG* p_l, LONG l)
+{
+    return(__atomic_exchange_n(p_l, l, __ATOMIC_SEQ_CST));
+}
+
+static inline LONGLONG InterlockedExchange64(volatile LONGLONG* p_ll, LONGLONG ll)
+{
+    return(__atomic_exchange_n(p_ll, ll, __ATOMIC_SEQ_CST));
+}
+
+static inline LONG InterlockedIncrement(volatile LONG* p_l)
+{
+    return(__atomic_add_fetch(p_l, 1, __ATOMIC_SEQ_CST));
+}
+
+static inline LONGLONG InterlockedIncrement64(volatile LONGLONG* p_ll)
+{
+    return(__atomic_add_fetch(p_ll, 1, __ATOMIC_SEQ_CST));
+}
+
+static inline LONG InterlockedCompareExchange(volatile LONG* p_l,
+    LONG lExchange, LONG lComparand)
+{
+    __atomic_compare_exchange_n(p_l, &lComparand, lExchange, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return(lComparand);
+}
+
+static inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p_ll,
+    LONGLONG llExchange, LONGLONG llComparand)
+{
+    __atomic_compare_exchange_n(p_ll, &llComparand, llExchange, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return(llComparand);
+}
+
+#define MemoryBarrier()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* The high-resolution clock, counting nanoseconds */
+static inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* p_li)
+{
+    p_li->QuadPart = 1000000000LL;
+    return(TRUE);
+}
+
+static inline BOOL QueryPerformanceCounter(LARGE_INTEGER* p_li)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    p_li->QuadPart = (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return(TRUE);
+}
+
+#endif
+
+#endif
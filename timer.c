@@ -5,8 +5,7 @@ This module provides timing services.
 
 /* Standard includes. */
 #include <stdio.h>
-#include <conio.h>
-#include <Windows.h>
+#include "tankport.h"
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
@@ -14,73 +13,198 @@ This module provides timing services.
 #include "timers.h"
 #include "semphr.h"
 #include "publics.h"
+#include "assert.h"
+
+/* Local Defines */
+/* Most callbacks that can be registered at once */
+#define TIMER_CALLBACKS_MAX  16
+
+/* Slots in the timer wheel.  A callback due at tick t waits in slot
+   t % TIMER_WHEEL_SLOTS, so each tick looks at one slot only. */
+#define TIMER_WHEEL_SLOTS    32
+
+/* Local Structures */
+typedef struct
+{
+    V_TIMER_CALLBACK vCallback;   /* NULL if the entry is free */
+    unsigned long ulPeriod;       /* Ticks between calls, or 0 for one call */
+    unsigned long long ullDue;    /* Tick at which it is next due */
+    int iNext;                    /* Next entry in the same slot, or TIMER_NONE */
+} TIMER_ENTRY;
+
+/* Static Functions */
+static void vTimerInsert(int iTimer);
 
 /* Static Data */
-/* Data about the time */
-static int iHours;
-static int iMinutes;
-static int iSeconds;
-static int iSecondTenths;
+/* The registered callbacks, and the wheel they wait in */
+static TIMER_ENTRY a_te[TIMER_CALLBACKS_MAX];
+static int a_iWheel[TIMER_WHEEL_SLOTS];
 
-/* The semaphore that protects the data */
-SemaphoreHandle_t SemTime;
+/* The time, as the number of 1/3-second ticks since the system
+   started.  It is only ever changed and read with interlocked
+   operations, so it needs no semaphore and never wraps. */
+static volatile LONGLONG llTicks;
+
+/* How many times faster than real time the simulated hardware runs */
+static volatile LONG lScale = 1;
 
 void vTimerInit(void) {
+    int i;
+
     /* Initialize the time */
-    iHours = 0;
-    iMinutes = 0;
-    iSeconds = 0;
-    iSecondTenths = 0;
-
-    /* Initialize the semaphore */
-    SemTime = xSemaphoreCreateBinary();
-    xSemaphoreGive(SemTime);
+    InterlockedExchange64(&llTicks, 0);
+
+    /* No callbacks yet */
+    for (i = 0; i < TIMER_CALLBACKS_MAX; ++i)
+        a_te[i].vCallback = NULL;
+    for (i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+        a_iWheel[i] = TIMER_NONE;
 }
 
 void vTimerOneThirdSecond(void) {
-    xSemaphoreTake(SemTime, portMAX_DELAY);
-
-    //vOverflowTime();
-
-    switch (iSecondTenths) {
-        case 0:
-            iSecondTenths = 3;
-            break;
-
-        case 3:
-            iSecondTenths = 7;
-            break;
-
-        case 7:
-            iSecondTenths = 0;
-            ++iSeconds;
-            if (iSeconds == 60) {
-                iSeconds = 0;
-                ++iMinutes;
-            }
-            if (iMinutes == 60) {
-                iMinutes = 0;
-                ++iHours;
-            }
-            if (iHours == 24) {
-                iHours = 0;
-            }
-
-            vDisplayUpdate();
-            break;
+    unsigned long long ullNow;
+    int* p_iLink;
+    int iDue;
+    int iTimer;
+
+    ullNow = (unsigned long long)InterlockedIncrement64(&llTicks);
+
+    /* Take what is due now out of its slot.  Anything else in the
+       slot is due on a later turn of the wheel and stays put. */
+    iDue = TIMER_NONE;
+    taskENTER_CRITICAL();
+    p_iLink = &a_iWheel[ullNow % TIMER_WHEEL_SLOTS];
+    while (*p_iLink != TIMER_NONE)
+    {
+        iTimer = *p_iLink;
+        if (a_te[iTimer].ullDue == ullNow)
+        {
+            *p_iLink = a_te[iTimer].iNext;
+            a_te[iTimer].iNext = iDue;
+            iDue = iTimer;
+        }
+        else
+        {
+            p_iLink = &a_te[iTimer].iNext;
+        }
     }
+    taskEXIT_CRITICAL();
+
+    /* Call them, with interrupts on, and put back the periodic ones */
+    while (iDue != TIMER_NONE)
+    {
+        iTimer = iDue;
+        iDue = a_te[iTimer].iNext;
+
+        a_te[iTimer].vCallback();
+
+        taskENTER_CRITICAL();
+        if (a_te[iTimer].ulPeriod != 0)
+        {
+            a_te[iTimer].ullDue = ullNow + a_te[iTimer].ulPeriod;
+            vTimerInsert(iTimer);
+        }
+        else
+        {
+            a_te[iTimer].vCallback = NULL;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+/* Registers a callback to be called after ulTicks 1/3-second ticks,
+   and then every ulTicks ticks if fPeriodic.  Returns a number for
+   vTimerCancel, or TIMER_NONE if there is no room. */
+int iTimerRegister(V_TIMER_CALLBACK vCallback, unsigned long ulTicks, BOOL fPeriodic) {
+    int iTimer;
+    int i;
+
+    assert(vCallback != NULL);
+    assert(ulTicks > 0);
+
+    iTimer = TIMER_NONE;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < TIMER_CALLBACKS_MAX && iTimer == TIMER_NONE; ++i)
+    {
+        if (a_te[i].vCallback == NULL)
+        {
+            iTimer = i;
+            a_te[iTimer].vCallback = vCallback;
+            a_te[iTimer].ulPeriod = fPeriodic ? ulTicks : 0;
+            a_te[iTimer].ullDue = ullTimeNowTicks() + ulTicks;
+            vTimerInsert(iTimer);
+        }
+    }
+    taskEXIT_CRITICAL();
 
-    xSemaphoreGive(SemTime);
+    return(iTimer);
 }
 
-void vTimeGet(int* a_time) {
-    
-    xSemaphoreTake(SemTime, portMAX_DELAY);
+/* Stops a callback registered with iTimerRegister */
+void vTimerCancel(int iTimer) {
+    int* p_iLink;
+
+    assert(iTimer >= 0 && iTimer < TIMER_CALLBACKS_MAX);
+
+    taskENTER_CRITICAL();
+    if (a_te[iTimer].vCallback != NULL)
+    {
+        /* Take it out of its slot, if it is in one.  A callback being
+           called right now is in no slot, and stopping its period is
+           enough to keep it from going back in. */
+        p_iLink = &a_iWheel[a_te[iTimer].ullDue % TIMER_WHEEL_SLOTS];
+        while (*p_iLink != TIMER_NONE && *p_iLink != iTimer)
+            p_iLink = &a_te[*p_iLink].iNext;
+        if (*p_iLink == iTimer)
+        {
+            *p_iLink = a_te[iTimer].iNext;
+            a_te[iTimer].vCallback = NULL;
+        }
+        a_te[iTimer].ulPeriod = 0;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/* Puts a callback into the slot for the tick it is due at.  Call
+   with interrupts off. */
+static void vTimerInsert(int iTimer) {
+    int iSlot;
+
+    iSlot = (int)(a_te[iTimer].ullDue % TIMER_WHEEL_SLOTS);
+    a_te[iTimer].iNext = a_iWheel[iSlot];
+    a_iWheel[iSlot] = iTimer;
+}
 
-    a_time[0] = iHours;
-    a_time[1] = iMinutes;
-    a_time[2] = iSeconds;
-    a_time[3] = iSecondTenths;
+void vTimerScaleSet(int iScale) {
+    assert(iScale >= 0);
 
-    xSemaphoreGive(SemTime);
-}
\ No newline at end of file
+    InterlockedExchange(&lScale, iScale);
+}
+
+int iTimerScale(void) {
+    return((int)lScale);
+}
+
+unsigned long long ullTimeNowTicks(void) {
+    /* Comparing with a value the count never has reads all 64 bits
+       at once, even on a 32-bit processor */
+    return((unsigned long long)InterlockedCompareExchange64(&llTicks, -1, -1));
+}
+
+void vTimeGet(int* a_time) {
+    
+    /* The tenths each tick of a second ends on */
+    static const int a_iTenths[TIMER_TICKS_PER_SECOND] = { 0, 3, 7 };
+    unsigned long long ullTicks;
+    unsigned long long ullSeconds;
+
+    ullTicks = ullTimeNowTicks();
+    ullSeconds = ullTicks / TIMER_TICKS_PER_SECOND;
+
+    /* The time of day shown wraps at 24 hours, though the count does not */
+    a_time[0] = (int)(ullSeconds / 3600 % 24);
+    a_time[1] = (int)(ullSeconds / 60 % 60);
+    a_time[2] = (int)(ullSeconds % 60);
+    a_time[3] = a_iTenths[ullTicks % TIMER_TICKS_PER_SECOND];
+}